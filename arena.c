@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "arena.h"
+
+int init_arena(Arena_t *arena, size_t size)
+{
+	void *base;
+
+	memset(arena, 0, sizeof(*arena));
+	size = arena_size(size);
+	if (posix_memalign(&base, CACHE_LINE_SIZE, size ? size : CACHE_LINE_SIZE))
+		return -ENOMEM;
+	memset(base, 0, size);
+	arena->base = (char *)base;
+	arena->size = size;
+	return 0;
+}
+
+void *arena_alloc(Arena_t *arena, size_t size)
+{
+	void *p;
+
+	size = arena_size(size);
+	if (arena->used + size > arena->size) {
+		printf("arena out of space, %zu of %zu used\n",
+			arena->used, arena->size);
+		return NULL;
+	}
+	p = arena->base + arena->used;
+	arena->used += size;
+	return p;
+}
+
+void destroy_arena(Arena_t *arena)
+{
+	free(arena->base);
+	memset(arena, 0, sizeof(*arena));
+}
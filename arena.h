@@ -0,0 +1,29 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE	64
+
+/*
+ * Bump allocator for state that lives as long as the run.  Every block
+ * starts on its own cache line and is zeroed; nothing is freed until
+ * destroy_arena().
+ */
+typedef struct arena {
+	char	*base;
+	size_t	size;
+	size_t	used;
+}Arena_t;
+
+/* Bytes @size takes in the arena, for sizing it up front */
+static inline size_t arena_size(size_t size)
+{
+	return (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+}
+
+int init_arena(Arena_t *arena, size_t size);
+void *arena_alloc(Arena_t *arena, size_t size);
+void destroy_arena(Arena_t *arena);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+
+Atomic counterparts of the bitops in non-atomic.h, on C11 atomics, for
+bitmaps more than one thread writes at a time
+
+*/
+#ifndef _ASM_GENERIC_BITOPS_ATOMIC_H_
+#define _ASM_GENERIC_BITOPS_ATOMIC_H_
+
+#include <stdatomic.h>
+
+/* same definition as bitmap.h, so either may come first */
+#ifndef BITS_PER_LONG
+#define BITS_PER_LONG ((int)sizeof(unsigned long)*8)
+#endif
+#include "non-atomic.h"
+
+/*
+ * Each op is one atomic read-modify-write of the word holding the bit.
+ * set/clear/change are relaxed, like the kernel's void atomic bitops;
+ * the test_and_* ones return the old value and are fully ordered.
+ */
+
+/**
+ * atomic_set_bit - Atomically set a bit in memory
+ * @nr: the bit to set
+ * @addr: the address to start counting from
+ */
+static inline void atomic_set_bit(int nr, _Atomic unsigned long *addr)
+{
+	atomic_fetch_or_explicit(addr + BITOP_WORD(nr), BITOP_MASK(nr),
+				memory_order_relaxed);
+}
+
+/**
+ * atomic_clear_bit - Atomically clear a bit in memory
+ * @nr: the bit to clear
+ * @addr: the address to start counting from
+ */
+static inline void atomic_clear_bit(int nr, _Atomic unsigned long *addr)
+{
+	atomic_fetch_and_explicit(addr + BITOP_WORD(nr), ~BITOP_MASK(nr),
+				memory_order_relaxed);
+}
+
+/**
+ * atomic_change_bit - Atomically toggle a bit in memory
+ * @nr: the bit to change
+ * @addr: the address to start counting from
+ */
+static inline void atomic_change_bit(int nr, _Atomic unsigned long *addr)
+{
+	atomic_fetch_xor_explicit(addr + BITOP_WORD(nr), BITOP_MASK(nr),
+				memory_order_relaxed);
+}
+
+/**
+ * atomic_test_and_set_bit - Set a bit and return its old value
+ * @nr: Bit to set
+ * @addr: Address to count from
+ *
+ * Exactly one of any number of racing callers sees 0.
+ */
+static inline int atomic_test_and_set_bit(int nr, _Atomic unsigned long *addr)
+{
+	unsigned long mask = BITOP_MASK(nr);
+
+	return (atomic_fetch_or(addr + BITOP_WORD(nr), mask) & mask) != 0;
+}
+
+/**
+ * atomic_test_and_clear_bit - Clear a bit and return its old value
+ * @nr: Bit to clear
+ * @addr: Address to count from
+ */
+static inline int atomic_test_and_clear_bit(int nr, _Atomic unsigned long *addr)
+{
+	unsigned long mask = BITOP_MASK(nr);
+
+	return (atomic_fetch_and(addr + BITOP_WORD(nr), ~mask) & mask) != 0;
+}
+
+/**
+ * atomic_test_and_change_bit - Change a bit and return its old value
+ * @nr: Bit to change
+ * @addr: Address to count from
+ */
+static inline int atomic_test_and_change_bit(int nr, _Atomic unsigned long *addr)
+{
+	unsigned long mask = BITOP_MASK(nr);
+
+	return (atomic_fetch_xor(addr + BITOP_WORD(nr), mask) & mask) != 0;
+}
+
+/**
+ * atomic_test_bit - Determine whether a bit is set
+ * @nr: bit number to test
+ * @addr: Address to start counting from
+ */
+static inline int atomic_test_bit(int nr, const _Atomic unsigned long *addr)
+{
+	return 1UL & (atomic_load_explicit(addr + BITOP_WORD(nr),
+				memory_order_relaxed) >> (nr & (BITS_PER_LONG-1)));
+}
+
+#endif /* _ASM_GENERIC_BITOPS_ATOMIC_H_ */
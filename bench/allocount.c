@@ -0,0 +1,65 @@
+/*
+ * LD_PRELOAD shim counting heap allocations.  selfstat.c picks up
+ * bench_alloc_count() when it is loaded and adds allocations per stage
+ * to --self-stats; the total is printed to stderr at exit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static unsigned long long nr_allocs;
+
+unsigned long long bench_alloc_count(void)
+{
+	return __atomic_load_n(&nr_allocs, __ATOMIC_RELAXED);
+}
+
+static inline void count(void)
+{
+	__atomic_fetch_add(&nr_allocs, 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+	count();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	count();
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	count();
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	count();
+	p = __libc_memalign(alignment, size);
+	if (!p)
+		return 12;	/* ENOMEM */
+	*memptr = p;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	count();
+	return __libc_memalign(alignment, size);
+}
+
+static void __attribute__((destructor)) allocount_report(void)
+{
+	fprintf(stderr, "allocs\t%llu\n", nr_allocs);
+}
@@ -0,0 +1,194 @@
+/*
+ * Stress the atomic cpumask ops against cpu_set()/cpu_clear() with
+ * threads writing interleaved cpus, so every word has several writers:
+ *
+ *   atomic_bench [THREADS] [ROUNDS]
+ *
+ * Each round the threads set, then clear, all their cpus at once and
+ * the main thread counts the bits that did not stick; then every thread
+ * runs atomic_cpu_test_and_set() on every cpu, which exactly one of
+ * them may win.  Prints "mode lost_sets lost_clears" lines and the
+ * single thread cost of each op, exits 1 if the atomic ops lost
+ * anything.  The plain ops only lose updates with more than one cpu.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../cpumask.h"
+
+#define MAX_THREADS	64
+#define BENCH_OPS	(1 << 24)
+
+enum bench_mode {
+	MODE_PLAIN = 0,
+	MODE_ATOMIC,
+	MODE_TEST_AND_SET,
+	MODE_STOP,
+};
+
+cpumask_t cpu_online_map;
+
+/* Keep the compiler from folding the mask away across iterations */
+#define touch(mask)	__asm__ volatile("" : : "r"(&(mask)) : "memory")
+
+static cpumask_t plain;
+static atomic_cpumask_t shared;
+static pthread_barrier_t start, done;
+static int nr_threads = 4;
+static int mode, clearing;		//written by main between barriers
+static unsigned long wins[MAX_THREADS];
+
+/* Thread id's share of the current phase */
+static void phase(int id)
+{
+	int cpu, i;
+
+	if (mode == MODE_TEST_AND_SET) {
+		/* everybody goes for every cpu, each from its own start */
+		for (i = 0; i < NR_CPUS; i++) {
+			cpu = (i + id * (NR_CPUS / nr_threads)) & (NR_CPUS - 1);
+			if (!atomic_cpu_test_and_set(cpu, shared))
+				wins[id]++;
+		}
+		return;
+	}
+
+	for (cpu = id; cpu < NR_CPUS; cpu += nr_threads) {
+		if (mode == MODE_ATOMIC && clearing)
+			atomic_cpu_clear(cpu, shared);
+		else if (mode == MODE_ATOMIC)
+			atomic_cpu_set(cpu, shared);
+		else if (clearing)
+			cpu_clear(cpu, plain);
+		else
+			cpu_set(cpu, plain);
+	}
+}
+
+static void *worker(void *arg)
+{
+	int id = (long)arg;
+
+	for (;;) {
+		pthread_barrier_wait(&start);
+		if (mode == MODE_STOP)
+			break;
+		phase(id);
+		pthread_barrier_wait(&done);
+	}
+	return NULL;
+}
+
+/* The main thread takes part as thread 0 */
+static void run_phase(void)
+{
+	pthread_barrier_wait(&start);
+	phase(0);
+	pthread_barrier_wait(&done);
+}
+
+/* Bits set in whichever mask the current mode writes */
+static int count_bits(void)
+{
+	cpumask_t copy;
+
+	if (mode != MODE_ATOMIC)
+		return cpus_weight(plain);
+	atomic_cpus_read(copy, shared);
+	return cpus_weight(copy);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void time_ops(void)
+{
+	unsigned long long t0, t1, t2;
+	int i;
+
+	t0 = now_ns();
+	for (i = 0; i < BENCH_OPS; i++) {
+		cpu_set(i & (NR_CPUS - 1), plain);
+		touch(plain);
+	}
+	t1 = now_ns();
+	for (i = 0; i < BENCH_OPS; i++)
+		atomic_cpu_set(i & (NR_CPUS - 1), shared);
+	t2 = now_ns();
+	printf("cost\tcpu_set:%.2fns\tatomic_cpu_set:%.2fns\n",
+		(double)(t1 - t0) / BENCH_OPS, (double)(t2 - t1) / BENCH_OPS);
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[MAX_THREADS];
+	unsigned long lost[2][2] = { { 0 } }, total = 0;
+	int rounds = 2000, round, i;
+
+	if (argc > 1)
+		nr_threads = atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if (nr_threads < 2 || nr_threads > MAX_THREADS || rounds < 1) {
+		fprintf(stderr, "usage: %s [THREADS 2-%d] [ROUNDS]\n",
+			argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	pthread_barrier_init(&start, NULL, nr_threads);
+	pthread_barrier_init(&done, NULL, nr_threads);
+	for (i = 1; i < nr_threads; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)(long)i);
+
+	for (round = 0; round < rounds; round++) {
+		for (mode = MODE_PLAIN; mode <= MODE_ATOMIC; mode++) {
+			clearing = 0;
+			cpus_clear(plain);
+			atomic_cpus_clear(shared);
+			run_phase();
+			lost[mode][0] += NR_CPUS - count_bits();
+
+			/* clear from full, whatever the set phase left */
+			cpus_setall(plain);
+			for (i = 0; i < NR_CPUS; i++)
+				atomic_cpu_set(i, shared);
+			clearing = 1;
+			run_phase();
+			lost[mode][1] += count_bits();
+		}
+
+		mode = MODE_TEST_AND_SET;
+		atomic_cpus_clear(shared);
+		run_phase();
+	}
+
+	mode = MODE_STOP;
+	pthread_barrier_wait(&start);
+	for (i = 1; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nr_threads; i++)
+		total += wins[i];
+	printf("threads\t%d\trounds\t%d\tcpus\t%d\n", nr_threads, rounds, NR_CPUS);
+	printf("plain\tlost_sets:%lu\tlost_clears:%lu\n",
+		lost[MODE_PLAIN][0], lost[MODE_PLAIN][1]);
+	printf("atomic\tlost_sets:%lu\tlost_clears:%lu\n",
+		lost[MODE_ATOMIC][0], lost[MODE_ATOMIC][1]);
+	printf("test_and_set\twins:%lu\texpected:%lu\n",
+		total, (unsigned long)rounds * NR_CPUS);
+	time_ops();
+
+	if (lost[MODE_ATOMIC][0] || lost[MODE_ATOMIC][1] ||
+	    total != (unsigned long)rounds * NR_CPUS) {
+		fprintf(stderr, "atomic cpumask ops lost updates\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,409 @@
+/*
+ * Hex mask formatting and parsing, bitmap_scnprintf() and
+ * __bitmap_parse(), against the chunk at a time versions they replaced,
+ * and cpulist parsing, __bitmap_parselist(), against the bit at a time
+ * version:
+ *
+ *   bitmap_bench
+ *
+ * Checks both give the same strings, masks and return values on a set
+ * of masks and malformed inputs at every width, checks the cpulist
+ * grammar the old parser lacked against expected masks, then prints
+ * "width op ref_ns new_ns" lines.  Exits 1 on any difference.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../bitmap.h"
+
+#define CHUNKSZ		32
+#define MAX_BITS	65536
+#define BUF_SIZE	(MAX_BITS / 4 + MAX_BITS / CHUNKSZ + 16)
+#define BENCH_WORK	(1 << 22)	//bits formatted/parsed per op, summed
+#define unhex(c)	(isdigit(c) ? (c - '0') : (toupper(c) - 'A' + 10))
+
+static const int widths[] = { 1, 33, 64, 100, 256, 1024, 4096, 16384, 65536 };
+
+static const char * const bad_inputs[] = {
+	"", ",", "1,,5", ",44", " 1f ", "1 2", "1, 2", "1 ,2", "\t3\n",
+	"000000000001", "1ffffffff", "F,0", "0,0,ff", "DEADBEEF,cafe", "g",
+	"ffffffff,ffffffff,ffffffff", "1,00000000,00000000", "0, 1",
+};
+
+/* Kernel cpulist syntax: input, width, return value, expected list */
+static const struct {
+	const char	*in;
+	int		nbits;
+	int		ret;
+	const char	*list;
+} list_cases[] = {
+	{ "0-1023:2/256", 1024, 0, "0-1,256-257,512-513,768-769" },
+	{ "0-N", 64, 0, "0-63" },
+	{ "N", 100, 0, "99" },
+	{ "all", 33, 0, "0-32" },
+	{ "all:1/2", 8, 0, "0,2,4,6" },
+	{ "4-N:3/8", 32, 0, "4-6,12-14,20-22,28-30" },
+	{ "0-63:1/4294967295", 64, 0, "0" },
+	{ "0-7:0/4", 64, 0, "" },
+	{ "", 64, 0, "" },
+	{ "\n", 64, 0, "" },
+	{ "2-5\n", 64, 0, "2-5" },
+	{ "1 3", 64, 0, "1,3" },
+	{ ",,5,", 64, 0, "5" },
+	{ "5-3", 64, -EINVAL, NULL },
+	{ "0-64", 64, -ERANGE, NULL },
+	{ "64", 64, -ERANGE, NULL },
+	{ "0-7:0/0", 64, -EINVAL, NULL },
+	{ "0-7:5/4", 64, -EINVAL, NULL },
+	{ "0-7:2", 64, -EINVAL, NULL },
+	{ "0-7:2/", 64, -EINVAL, NULL },
+	{ "1-", 64, -EINVAL, NULL },
+	{ "-1", 64, -EINVAL, NULL },
+	{ "1x", 64, -EINVAL, NULL },
+	{ "al", 64, -EINVAL, NULL },
+	{ "99999999999", 64, -EOVERFLOW, NULL },
+};
+
+static unsigned long ref_mask[BITS_TO_LONGS(MAX_BITS)];
+static unsigned long new_mask[BITS_TO_LONGS(MAX_BITS)];
+static unsigned long src_mask[BITS_TO_LONGS(MAX_BITS)];
+static char ref_buf[BUF_SIZE], new_buf[BUF_SIZE];
+
+/* bitmap_scnprintf() as it was, one snprintf per chunk */
+static int ref_scnprintf(char *buf, unsigned int buflen,
+	const unsigned long *maskp, int nmaskbits)
+{
+	int i, word, bit, len = 0;
+	unsigned long val;
+	const char *sep = "";
+	int chunksz;
+	uint32_t chunkmask;
+	int first = 1;
+
+	chunksz = nmaskbits & (CHUNKSZ - 1);
+	if (chunksz == 0)
+		chunksz = CHUNKSZ;
+
+	i = ALIGN(nmaskbits, CHUNKSZ) - CHUNKSZ;
+	for (; i >= 0; i -= CHUNKSZ) {
+		chunkmask = ((1ULL << chunksz) - 1);
+		word = i / BITS_PER_LONG;
+		bit = i % BITS_PER_LONG;
+		val = (maskp[word] >> bit) & chunkmask;
+		if (val!=0 || !first || i==0)  {
+			len += snprintf(buf+len, buflen-len, "%s%0*lx", sep,
+				(chunksz+3)/4, val);
+			sep = ",";
+			first = 0;
+		}
+		chunksz = CHUNKSZ;
+	}
+	return len;
+}
+
+/* __bitmap_parse() as it was, a whole bitmap shift per chunk */
+static int ref_parse(const char *buf, unsigned int buflen,
+		unsigned long *maskp, int nmaskbits)
+{
+	int c, old_c, totaldigits, ndigits, nchunks, nbits;
+	uint32_t chunk;
+
+	bitmap_zero(maskp, nmaskbits);
+
+	nchunks = nbits = totaldigits = c = 0;
+	do {
+		chunk = ndigits = 0;
+		while (buflen) {
+			old_c = c;
+			c = *buf++;
+			buflen--;
+			if (isspace(c))
+				continue;
+			if (totaldigits && c && isspace(old_c))
+				return 0;
+			if (c == '\0' || c == ',')
+				break;
+			if (!isxdigit(c))
+				return -EINVAL;
+			if (chunk & ~((1UL << (CHUNKSZ - 4)) - 1))
+				return -EOVERFLOW;
+			chunk = (chunk << 4) | unhex(c);
+			ndigits++; totaldigits++;
+		}
+		if (ndigits == 0)
+			return -EINVAL;
+		if (nchunks == 0 && chunk == 0)
+			continue;
+
+		__bitmap_shift_left(maskp, maskp, CHUNKSZ, nmaskbits);
+		*maskp |= chunk;
+		nchunks++;
+		nbits += (nchunks == 1) ? fls(chunk) : CHUNKSZ;
+		if (nbits > nmaskbits)
+			return -EOVERFLOW;
+	} while (buflen && c == ',');
+
+	return 0;
+}
+
+/* __bitmap_parselist() as it was, one set_bit() per cpu */
+static int ref_parselist(const char *buf, unsigned int buflen,
+		unsigned long *maskp, int nmaskbits)
+{
+	int a, b, c, old_c, totaldigits;
+	int exp_digit, in_range;
+
+	totaldigits = c = 0;
+	bitmap_zero(maskp, nmaskbits);
+	do {
+		exp_digit = 1;
+		in_range = 0;
+		a = b = 0;
+
+		while (buflen) {
+			old_c = c;
+			c = *buf++;
+			buflen--;
+			if (isspace(c))
+				continue;
+			if (totaldigits && c && isspace(old_c))
+				return -EINVAL;
+			if (c == '\0' || c == ',')
+				break;
+			if (c == '-') {
+				if (exp_digit || in_range)
+					return -EINVAL;
+				b = 0;
+				in_range = 1;
+				exp_digit = 1;
+				continue;
+			}
+			if (!isdigit(c))
+				return -EINVAL;
+			b = b * 10 + (c - '0');
+			if (!in_range)
+				a = b;
+			exp_digit = 0;
+			totaldigits++;
+		}
+		if (!(a <= b))
+			return -EINVAL;
+		if (b >= nmaskbits)
+			return -ERANGE;
+		while (a <= b) {
+			set_bit(a, maskp);
+			a++;
+		}
+	} while (buflen && c == ',');
+	return 0;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long rnd(void)
+{
+	static unsigned long long x = 88172645463325252ULL;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+/* Pattern @kind of @nbits bits into src_mask */
+static void make_mask(int kind, int nbits)
+{
+	int i;
+
+	bitmap_zero(src_mask, MAX_BITS);
+	for (i = 0; i < nbits; i++) {
+		switch (kind) {
+		case 0:				/* empty */
+			break;
+		case 1:				/* full */
+			set_bit(i, src_mask);
+			break;
+		case 2:				/* top bit only */
+			if (i == nbits - 1)
+				set_bit(i, src_mask);
+			break;
+		case 3:				/* every 8th, isolated cpus */
+			if (!(i & 7))
+				set_bit(i, src_mask);
+			break;
+		case 4:				/* sparse */
+			if (!(rnd() & 63))
+				set_bit(i, src_mask);
+			break;
+		default:			/* dense random */
+			if (rnd() & 1)
+				set_bit(i, src_mask);
+			break;
+		}
+	}
+}
+#define NR_KINDS	6
+
+static int same_mask(int nbits)
+{
+	int i;
+
+	for (i = 0; i < nbits; i++)
+		if (!!test_bit(i, ref_mask) != !!test_bit(i, new_mask))
+			return 0;
+	return 1;
+}
+
+/* Both parsers on @str; the masks only mean something on success */
+static int check_parse(const char *str, unsigned int len, int nbits)
+{
+	int ref, ret;
+
+	ref = ref_parse(str, len, ref_mask, nbits);
+	ret = __bitmap_parse(str, len, 0, new_mask, nbits);
+	if (ref != ret || (!ret && !same_mask(nbits))) {
+		fprintf(stderr, "parse differs, width:%d ret:%d/%d input:\"%.64s\"\n",
+			nbits, ref, ret, str);
+		return -1;
+	}
+	return 0;
+}
+
+/* Old and new cpulist parsers on @str, which the old grammar covers */
+static int check_parselist(const char *str, int nbits)
+{
+	int ref, ret;
+
+	ref = ref_parselist(str, strlen(str) + 1, ref_mask, nbits);
+	ret = __bitmap_parselist(str, strlen(str) + 1, 0, new_mask, nbits);
+	if (ref != ret || (!ret && !same_mask(nbits))) {
+		fprintf(stderr, "parselist differs, width:%d ret:%d/%d input:\"%.64s\"\n",
+			nbits, ref, ret, str);
+		return -1;
+	}
+	return 0;
+}
+
+static int check_list_cases(void)
+{
+	int i, ret, bad = 0;
+
+	for (i = 0; i < (int)(sizeof(list_cases) / sizeof(list_cases[0])); i++) {
+		ret = __bitmap_parselist(list_cases[i].in,
+				strlen(list_cases[i].in) + 1, 0, new_mask,
+				list_cases[i].nbits);
+		if (!ret)
+			bitmap_scnlistprintf(new_buf, BUF_SIZE, new_mask,
+				list_cases[i].nbits);
+		if (ret != list_cases[i].ret ||
+		    (!ret && strcmp(new_buf, list_cases[i].list))) {
+			fprintf(stderr, "parselist \"%s\" width:%d gave %d \"%s\"\n",
+				list_cases[i].in, list_cases[i].nbits, ret,
+				ret ? "" : new_buf);
+			bad = -1;
+		}
+	}
+	return bad;
+}
+
+static int check(int nbits)
+{
+	int kind, len, i, bad = 0;
+
+	for (kind = 0; kind < NR_KINDS; kind++) {
+		make_mask(kind, nbits);
+		len = ref_scnprintf(ref_buf, BUF_SIZE, src_mask, nbits);
+		if (bitmap_scnprintf(new_buf, BUF_SIZE, src_mask, nbits) != len ||
+		    strcmp(ref_buf, new_buf)) {
+			fprintf(stderr, "format differs, width:%d kind:%d\n",
+				nbits, kind);
+			bad = -1;
+		}
+		if (check_parse(ref_buf, len + 1, nbits) < 0)
+			bad = -1;
+		/* a buffer cut short of the terminating NUL */
+		if (len > 1 && check_parse(ref_buf, len - 1, nbits) < 0)
+			bad = -1;
+		/* the old parser took an empty list for bit 0 */
+		bitmap_scnlistprintf(ref_buf, BUF_SIZE, src_mask, nbits);
+		if (*ref_buf && check_parselist(ref_buf, nbits) < 0)
+			bad = -1;
+	}
+	for (i = 0; i < (int)(sizeof(bad_inputs) / sizeof(bad_inputs[0])); i++)
+		if (check_parse(bad_inputs[i], strlen(bad_inputs[i]) + 1, nbits) < 0)
+			bad = -1;
+	return bad;
+}
+
+static void bench(int nbits)
+{
+	int iters = BENCH_WORK / nbits, i, len, kind;
+	unsigned long long t0, t1, t2;
+
+	make_mask(NR_KINDS - 1, nbits);
+	t0 = now_ns();
+	for (i = 0; i < iters; i++)
+		ref_scnprintf(ref_buf, BUF_SIZE, src_mask, nbits);
+	t1 = now_ns();
+	for (i = 0; i < iters; i++)
+		bitmap_scnprintf(new_buf, BUF_SIZE, src_mask, nbits);
+	t2 = now_ns();
+	printf("%d\tformat\t%.0f\t%.0f\n", nbits,
+		(double)(t1 - t0) / iters, (double)(t2 - t1) / iters);
+
+	len = strlen(ref_buf) + 1;
+	t0 = now_ns();
+	for (i = 0; i < iters; i++)
+		ref_parse(ref_buf, len, ref_mask, nbits);
+	t1 = now_ns();
+	for (i = 0; i < iters; i++)
+		__bitmap_parse(ref_buf, len, 0, new_mask, nbits);
+	t2 = now_ns();
+	printf("%d\tparse\t%.0f\t%.0f\n", nbits,
+		(double)(t1 - t0) / iters, (double)(t2 - t1) / iters);
+
+	/* a whole range, then the list of every 8th cpu */
+	snprintf(ref_buf, BUF_SIZE, "0-%d", nbits - 1);
+	for (kind = 0; kind < 2; kind++) {
+		if (kind) {
+			make_mask(3, nbits);
+			bitmap_scnlistprintf(ref_buf, BUF_SIZE, src_mask, nbits);
+		}
+		len = strlen(ref_buf) + 1;
+		t0 = now_ns();
+		for (i = 0; i < iters; i++)
+			ref_parselist(ref_buf, len, ref_mask, nbits);
+		t1 = now_ns();
+		for (i = 0; i < iters; i++)
+			__bitmap_parselist(ref_buf, len, 0, new_mask, nbits);
+		t2 = now_ns();
+		printf("%d\t%s\t%.0f\t%.0f\n", nbits, kind ? "list" : "range",
+			(double)(t1 - t0) / iters, (double)(t2 - t1) / iters);
+	}
+}
+
+int main(void)
+{
+	int i, bad = 0;
+
+	for (i = 0; i < (int)(sizeof(widths) / sizeof(widths[0])); i++)
+		if (check(widths[i]) < 0)
+			bad = 1;
+	if (check_list_cases() < 0)
+		bad = 1;
+	if (bad)
+		return 1;
+	for (i = 0; i < (int)(sizeof(widths) / sizeof(widths[0])); i++)
+		if (widths[i] >= 64)
+			bench(widths[i]);
+	return 0;
+}
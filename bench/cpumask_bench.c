@@ -0,0 +1,104 @@
+/*
+ * Time the cpumask operations the sampler runs every tick, built once
+ * per width with the fixed width fast paths and once with
+ * CPUMASK_GENERIC (see the Makefile):
+ *
+ *   cpumask_bench
+ *
+ * Prints "op ns_per_op" lines to stdout.  The online mask has every
+ * cpu but each 8th, the way a box with some cpus isolated looks.
+ */
+#include <stdio.h>
+#include <time.h>
+
+#include "../cpumask.h"
+
+#define BENCH_WORK	(1 << 24)	//bits touched per op, summed over the run
+
+cpumask_t cpu_online_map;
+
+/* Keep the compiler from folding the mask away across iterations */
+#define touch(mask)	__asm__ volatile("" : : "r"(&(mask)) : "memory")
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *op, unsigned long long start, int iters)
+{
+	printf("%s\t%.1f\n", op, (double)(now_ns() - start) / iters);
+}
+
+int main(void)
+{
+	cpumask_t online, prev, quiet, steal, dst;
+	int iters = BENCH_WORK / NR_CPUS;
+	unsigned long long start;
+	volatile unsigned int sink = 0;
+	int i, cpu;
+
+	cpus_clear(quiet);
+	for (cpu = 0; cpu < NR_CPUS; cpu += 8)
+		cpu_set(cpu, quiet);
+	cpus_clear(steal);
+
+	/* cpu_online_map as parse_cpu_info() rebuilds it, same code both ways */
+	cpus_clear(online);
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (cpu & 7)
+			cpu_set(cpu, online);
+	prev = online;
+
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		unsigned int sum = 0;
+
+		touch(online);
+		for_each_cpu_mask(cpu, online)
+			sum += cpu;
+		sink += sum;
+	}
+	report("for_each", start, iters);
+
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		touch(online);
+		sink += cpus_equal(online, prev);
+	}
+	report("equal", start, iters);
+
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		touch(steal);
+		sink += cpus_empty(steal);
+	}
+	report("empty", start, iters);
+
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		touch(online);
+		sink += cpus_weight(online);
+	}
+	report("weight", start, iters);
+
+	start = now_ns();
+	for (i = 0; i < iters; i++) {
+		touch(online);
+		cpus_or(dst, online, quiet);
+		cpus_andnot(dst, dst, quiet);
+		touch(dst);
+	}
+	report("or_andnot", start, iters);
+
+	/* both builds must agree */
+	if (!cpus_equal(dst, online) || cpus_weight(online) != NR_CPUS - NR_CPUS / 8 ||
+	    first_cpu(online) != 1) {
+		fprintf(stderr, "cpumask results differ\n");
+		return 1;
+	}
+	return 0;
+}
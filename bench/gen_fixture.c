@@ -0,0 +1,279 @@
+/*
+ * Write a synthetic /proc and /sys tree for system_monitor --root:
+ *
+ *   gen_fixture DIR NR_CPUS [NR_ZONES]
+ *
+ * The machine has 2 threads per core, 16 cpus per LLC, 64 cpus per
+ * package and one NUMA node per package.  Every cpu gets cpufreq, cache,
+ * topology and 3 cpuidle states; NR_ZONES (default NR_CPUS / 4, at least
+ * 8) thermal zones alternate between cpu and gpu types.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PATH_MAX		4096
+#define THREADS_PER_CORE	2
+#define CPUS_PER_LLC		16
+#define CPUS_PER_PACKAGE	64
+
+static const char *root;
+
+/* mkdir -p of the directory part of @path */
+static void make_parents(char *path)
+{
+	char *p;
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+			perror(path);
+			exit(1);
+		}
+		*p = '/';
+	}
+}
+
+static void put(const char *name, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* Write one file under the root, @name is relative to it */
+static void put(const char *name, const char *fmt, ...)
+{
+	char path[PATH_MAX];
+	va_list ap;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	make_parents(path);
+	file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+	va_start(ap, fmt);
+	vfprintf(file, fmt, ap);
+	va_end(ap);
+	fclose(file);
+}
+
+static void range(char *buf, size_t size, int first, int nr)
+{
+	if (nr == 1)
+		snprintf(buf, size, "%d", first);
+	else
+		snprintf(buf, size, "%d-%d", first, first + nr - 1);
+}
+
+static void gen_proc(int nr_cpus)
+{
+	char path[PATH_MAX];
+	FILE *file;
+	int cpu;
+
+	snprintf(path, sizeof(path), "%s/proc/stat", root);
+	make_parents(path);
+	file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(file, "cpu  %llu 120 %llu %llu 300 0 500 0 0 0\n",
+		1000ULL * nr_cpus, 800ULL * nr_cpus, 90000ULL * nr_cpus);
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		fprintf(file, "cpu%d %d %d %d %d %d %d %d 0 0 0\n", cpu,
+			1000 + cpu % 97, cpu % 3, 800 + cpu % 89, 90000 + cpu,
+			cpu % 7, cpu % 5, 500 + cpu % 11);
+	fprintf(file, "intr 123456789");
+	for (cpu = 0; cpu < 256; cpu++)
+		fprintf(file, " %d", cpu % 13 ? 0 : cpu * 1000);
+	fprintf(file, "\nctxt 987654321\nbtime 1700000000\n"
+		"processes 123456\nprocs_running 3\nprocs_blocked 0\n"
+		"softirq 5555555 10 2000 30 4000 500 0 60 7000 0 800\n");
+	fclose(file);
+
+	snprintf(path, sizeof(path), "%s/proc/schedstat", root);
+	file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(file, "version 15\ntimestamp 4297299139\n");
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		fprintf(file, "cpu%d 0 0 %d %d %d %d %llu %llu %d\n", cpu,
+			2340 + cpu, 1068 + cpu, 1113 + cpu, 535 + cpu,
+			1587163536ULL + cpu * 1000ULL, 83196447ULL + cpu * 100ULL,
+			1272 + cpu);
+		fprintf(file, "domain0 ffffffff 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 "
+			"0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n");
+	}
+	fclose(file);
+
+	put("proc/meminfo",
+		"MemTotal:       %8d kB\nMemFree:         4096000 kB\n"
+		"MemAvailable:    6144000 kB\nBuffers:          102400 kB\n"
+		"Cached:          1024000 kB\nSwapCached:            0 kB\n"
+		"Active:          2048000 kB\nInactive:        1024000 kB\n"
+		"SwapTotal:       2097148 kB\nSwapFree:        2097148 kB\n"
+		"Dirty:               128 kB\nWriteback:             0 kB\n"
+		"AnonPages:        512000 kB\nMapped:           256000 kB\n"
+		"Shmem:             64000 kB\n", 8192000);
+	put("proc/vmstat",
+		"nr_free_pages 1024000\nnr_inactive_anon 1000\nnr_active_anon 2000\n"
+		"pgpgin 123456\npgpgout 654321\npswpin 0\npswpout 0\n"
+		"pgfault 99999999\npgmajfault 1234\npgscan_kswapd 0\n"
+		"pgscan_direct 0\noom_kill 0\n");
+	put("proc/pressure/cpu",
+		"some avg10=0.50 avg60=0.40 avg300=0.30 total=123456\n"
+		"full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+	put("proc/pressure/memory",
+		"some avg10=0.00 avg60=0.00 avg300=0.00 total=1000\n"
+		"full avg10=0.00 avg60=0.00 avg300=0.00 total=500\n");
+	put("proc/pressure/io",
+		"some avg10=0.10 avg60=0.10 avg300=0.10 total=50000\n"
+		"full avg10=0.05 avg60=0.05 avg300=0.05 total=25000\n");
+	put("proc/diskstats",
+		" 253       0 vda 10000 100 800000 5000 20000 200 1600000 9000 0 12000 14000 0 0 0 0\n"
+		" 253      16 vdb 500 0 4000 100 0 0 0 0 0 100 100 0 0 0 0\n"
+		" 259       0 nvme0n1 90000 10 7200000 30000 80000 5 6400000 40000 2 50000 70000 0 0 0 0\n"
+		"   7       0 loop0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n");
+	put("proc/net/dev",
+		"Inter-|   Receive                                                |  Transmit\n"
+		" face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n"
+		"    lo: 1000000 10000 0 0 0 0 0 0 1000000 10000 0 0 0 0 0 0\n"
+		"  eth0: 900000000 700000 0 10 0 0 0 100 300000000 500000 0 0 0 0 0 0\n"
+		"  eth1: 5000 50 0 0 0 0 0 0 4000 40 0 0 0 0 0 0\n");
+}
+
+static void gen_cpu(int cpu, int nr_cpus)
+{
+	static const char *idle_names[] = { "POLL", "C1", "C6" };
+	static const int idle_latency[] = { 0, 2, 133 };
+	char name[PATH_MAX], list[64];
+	int core = cpu / THREADS_PER_CORE;
+	int llc = cpu / CPUS_PER_LLC;
+	int package = cpu / CPUS_PER_PACKAGE;
+	int nr, i;
+
+	snprintf(name, sizeof(name), "sys/devices/system/cpu/cpu%d/online", cpu);
+	put(name, "1\n");
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_cur_freq", cpu);
+	put(name, "%d\n", 1200000 + (cpu % 16) * 100000);
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+	put(name, "%d\n", 1200000 + (cpu % 16) * 100000);
+
+	nr = nr_cpus - core * THREADS_PER_CORE;
+	range(list, sizeof(list), core * THREADS_PER_CORE,
+		nr < THREADS_PER_CORE ? nr : THREADS_PER_CORE);
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/topology/core_cpus_list", cpu);
+	put(name, "%s\n", list);
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+	put(name, "%s\n", list);
+
+	nr = nr_cpus - package * CPUS_PER_PACKAGE;
+	range(list, sizeof(list), package * CPUS_PER_PACKAGE,
+		nr < CPUS_PER_PACKAGE ? nr : CPUS_PER_PACKAGE);
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/topology/package_cpus_list", cpu);
+	put(name, "%s\n", list);
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/topology/core_siblings_list", cpu);
+	put(name, "%s\n", list);
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+	put(name, "%d\n", package);
+	snprintf(name, sizeof(name),
+		"sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+	put(name, "%d\n", core % (CPUS_PER_PACKAGE / THREADS_PER_CORE));
+
+	/* L1d, L2 per core, L3 per LLC group */
+	for (i = 0; i < 3; i++) {
+		int first = i < 2 ? core * THREADS_PER_CORE : llc * CPUS_PER_LLC;
+		int span = i < 2 ? THREADS_PER_CORE : CPUS_PER_LLC;
+
+		nr = nr_cpus - first;
+		range(list, sizeof(list), first, nr < span ? nr : span);
+		snprintf(name, sizeof(name),
+			"sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, i);
+		put(name, "%d\n", i + 1);
+		snprintf(name, sizeof(name),
+			"sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+			cpu, i);
+		put(name, "%s\n", list);
+	}
+
+	for (i = 0; i < 3; i++) {
+		const char *attr[] = { "name", "latency", "time", "usage" };
+		int a;
+
+		for (a = 0; a < 4; a++) {
+			snprintf(name, sizeof(name),
+				"sys/devices/system/cpu/cpu%d/cpuidle/state%d/%s",
+				cpu, i, attr[a]);
+			if (a == 0)
+				put(name, "%s\n", idle_names[i]);
+			else if (a == 1)
+				put(name, "%d\n", idle_latency[i]);
+			else
+				put(name, "%d\n", (cpu + 1) * (i + 1) * (a == 2 ? 100000 : 10));
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char list[64], name[PATH_MAX];
+	int nr_cpus, nr_zones, nr_packages;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s DIR NR_CPUS [NR_ZONES]\n", argv[0]);
+		return 1;
+	}
+	root = argv[1];
+	nr_cpus = atoi(argv[2]);
+	if (nr_cpus <= 0) {
+		fprintf(stderr, "bad cpu count:%s\n", argv[2]);
+		return 1;
+	}
+	nr_zones = argc > 3 ? atoi(argv[3]) : nr_cpus / 4;
+	if (nr_zones < 8)
+		nr_zones = 8;
+	nr_packages = (nr_cpus + CPUS_PER_PACKAGE - 1) / CPUS_PER_PACKAGE;
+
+	gen_proc(nr_cpus);
+
+	range(list, sizeof(list), 0, nr_cpus);
+	put("sys/devices/system/cpu/online", "%s\n", list);
+	put("sys/devices/system/cpu/possible", "%s\n", list);
+	put("sys/devices/system/cpu/present", "%s\n", list);
+	for (i = 0; i < nr_cpus; i++)
+		gen_cpu(i, nr_cpus);
+
+	for (i = 0; i < nr_packages; i++) {
+		int nr = nr_cpus - i * CPUS_PER_PACKAGE;
+
+		range(list, sizeof(list), i * CPUS_PER_PACKAGE,
+			nr < CPUS_PER_PACKAGE ? nr : CPUS_PER_PACKAGE);
+		snprintf(name, sizeof(name), "sys/devices/system/node/node%d/cpulist", i);
+		put(name, "%s\n", list);
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		snprintf(name, sizeof(name),
+			"sys/devices/virtual/thermal/thermal_zone%d/type", i);
+		put(name, "%s\n", i % 2 ? "gpu-thermal" : "cpu-thermal");
+		snprintf(name, sizeof(name),
+			"sys/devices/virtual/thermal/thermal_zone%d/temp", i);
+		put(name, "%d\n", 40000 + (i % 20) * 500);
+	}
+	return 0;
+}
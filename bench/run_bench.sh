@@ -0,0 +1,147 @@
+#!/bin/sh
+#
+# For every fixture size: per stage latency and allocations from
+# --self-stats under the allocount shim, then syscalls and allocations
+# per tick in steady state, taken as the difference between a TICKS and
+# a 2*TICKS run so start-up and the warm-up sample cancel out; any
+# allocation left in steady state fails the run.  Then the cpufreq
+# stage on 1..N --threads with padded and packed per cpu records, the
+# tick cost with and without -m, parse and display throughput replaying
+# a capture of each tree, the per tick cpumask ops with and without the
+# fixed width paths, and last hex mask formatting and parsing against
+# the old versions.
+#
+set -e
+cd "$(dirname "$0")"
+
+SIZES=${SIZES:-"8 64 512 4096"}
+TICKS=${TICKS:-100}
+THREADS=${THREADS:-"1 2 4 8"}
+MASK_WIDTHS=${MASK_WIDTHS:-"64 256 1024 4096"}
+FIXTURES=${FIXTURES:-fixtures}
+leaked=
+
+run() {
+	# $1 ticks, rest extra wrapper; stderr carries the counters
+	ticks=$1
+	shift
+	"$@" env LD_PRELOAD=./allocount.so ./system_monitor --root "$dir" \
+		-c "$ticks" -d 0 $BENCH_FLAGS --self-stats 2>&1 >/dev/null
+}
+
+counter() {
+	awk -v key="$1" '$1 == key { print $2 }'
+}
+
+printf "%-6s %-8s %10s %10s %10s %10s %8s\n" \
+	cpus stage avg_ns p50_ns p99_ns max_ns allocs
+for n in $SIZES; do
+	dir=$FIXTURES/cpu$n
+	[ -d "$dir" ] || ./gen_fixture "$dir" "$n"
+
+	LD_PRELOAD=./allocount.so ./system_monitor --root "$dir" -c "$TICKS" \
+		-d 0 $BENCH_FLAGS --self-stats 2>/dev/null |
+	awk -v n="$n" '$1 == "self" && $2 != "stage" && $2 != "overhead" {
+		printf "%-6s %-8s %10s %10s %10s %10s %8s\n", n, $2, $4, $5, $6, $7, $8
+	}'
+done
+
+echo
+printf "%-6s %14s %14s\n" cpus syscalls/tick allocs/tick
+for n in $SIZES; do
+	dir=$FIXTURES/cpu$n
+	if [ -x ./sctrace ] && ./sctrace true 2>/dev/null; then
+		out1=$(run "$TICKS" ./sctrace)
+		out2=$(run $((TICKS * 2)) ./sctrace)
+		sc=$(( ($(echo "$out2" | counter syscalls) - \
+			$(echo "$out1" | counter syscalls)) / TICKS ))
+	else
+		out1=$(run "$TICKS")
+		out2=$(run $((TICKS * 2)))
+		sc="n/a"
+	fi
+	al=$(( $(echo "$out2" | counter allocs) - \
+		$(echo "$out1" | counter allocs) ))
+	printf "%-6s %14s %14s\n" "$n" "$sc" $((al / TICKS))
+	# steady state ticks must not touch the heap at all
+	[ "$al" -eq 0 ] || leaked="$leaked $n"
+done
+if [ -n "$leaked" ]; then
+	echo "steady state heap allocations with cpus:$leaked" >&2
+	exit 1
+fi
+
+# cpufreq stage avg_ns, the one --threads splits, with and without the
+# per cpu record padding; scaling needs as many idle cpus as threads
+stage_ns() {
+	"$1" --root "$dir" -c "$TICKS" -d 0 --threads "$2" --self-stats \
+		2>/dev/null | awk '$1 == "self" && $2 == "cpufreq" { print $4 }'
+}
+
+echo
+echo "cpufreq stage avg_ns, $(getconf _NPROCESSORS_ONLN) cpus online"
+printf "%-6s %-8s %12s %12s\n" cpus threads padded packed
+for n in $SIZES; do
+	dir=$FIXTURES/cpu$n
+	for t in $THREADS; do
+		printf "%-6s %-8s %12s %12s\n" "$n" "$t" \
+			"$(stage_ns ./system_monitor "$t")" \
+			"$(stage_ns ./system_monitor_packed "$t")"
+	done
+done
+
+# whole tick cpu time without and with -m, the meminfo, vmstat and psi
+# reads ride the same tick and should add little on top
+tick_us() {
+	./system_monitor --root "$dir" -c "$TICKS" -d 0 $1 --self-stats \
+		2>/dev/null | awk -v ticks="$TICKS" '$1 == "self" && $2 == "overhead" {
+		sub("cpu:", "", $3); sub("ms", "", $3)
+		printf "%.1f", $3 * 1000 / ticks
+	}'
+}
+
+echo
+printf "%-6s %12s %12s\n" cpus tick_us tick_us_-m
+for n in $SIZES; do
+	dir=$FIXTURES/cpu$n
+	printf "%-6s %12s %12s\n" "$n" "$(tick_us)" "$(tick_us -m)"
+done
+
+# parse and format throughput, no file reads, from a recorded capture
+echo
+printf "%-6s %14s\n" cpus replay_tick/s
+for n in $SIZES; do
+	dir=$FIXTURES/cpu$n
+	rm -rf "$dir.cap"
+	./system_monitor --root "$dir" --record "$dir.cap" -c "$TICKS" -d 0 \
+		>/dev/null 2>&1
+	./system_monitor --replay "$dir.cap" 2>&1 >/dev/null |
+	awk -v n="$n" '$1 == "replay" {
+		sub("rate:", "", $4)
+		printf "%-6s %14s\n", n, $4
+	}'
+done
+
+# per tick cpumask ops, ns per op, for each NR_CPUS width
+echo
+printf "%-6s %-10s %10s %10s\n" width op generic fixed
+for w in $MASK_WIDTHS; do
+	./cpumask_bench_generic_$w > cpumask.generic
+	./cpumask_bench_$w > cpumask.fixed
+	paste cpumask.generic cpumask.fixed |
+	awk -v w="$w" '{ printf "%-6s %-10s %10s %10s\n", w, $1, $2, $4 }'
+	rm -f cpumask.generic cpumask.fixed
+done
+
+# fails on any output, mask or return value that differs
+echo
+printf "%-6s %-8s %12s %12s\n" bits op old_ns new_ns
+./bitmap_bench > bitmap.out
+awk '{ printf "%-6s %-8s %12s %12s\n", $1, $2, $3, $4 }' bitmap.out
+rm -f bitmap.out
+
+# fails if the atomic ops lose a set, a clear or a test_and_set winner
+echo
+./atomic_bench > atomic.out
+awk '{ printf "%-13s %s %s %s\n", $1, $2, $3, $4 }' atomic.out
+rm -f atomic.out
@@ -0,0 +1,99 @@
+/*
+ * Count the system calls of a command and its threads with ptrace, for
+ * boxes without strace:
+ *
+ *   sctrace COMMAND [ARGS...]
+ *
+ * Prints "syscalls TOTAL" and the busiest syscall numbers to stderr.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/ptrace.h>
+
+#define NR_SYSCALLS	1024
+#define NR_TOP		8
+
+static unsigned long long calls[NR_SYSCALLS];
+
+static void report(void)
+{
+	unsigned long long total = 0;
+	int i, n;
+
+	for (i = 0; i < NR_SYSCALLS; i++)
+		total += calls[i];
+	fprintf(stderr, "syscalls\t%llu\n", total);
+	for (n = 0; n < NR_TOP; n++) {
+		int top = 0;
+
+		for (i = 1; i < NR_SYSCALLS; i++)
+			if (calls[i] > calls[top])
+				top = i;
+		if (!calls[top])
+			break;
+		fprintf(stderr, "syscall\tnr:%d\t%llu\n", top, calls[top]);
+		calls[top] = 0;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int status, exit_code = 0;
+	pid_t child, pid;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s COMMAND [ARGS...]\n", argv[0]);
+		return 1;
+	}
+
+	child = fork();
+	if (child < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!child) {
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+		execvp(argv[1], argv + 1);
+		perror(argv[1]);
+		_exit(127);
+	}
+
+	if (waitpid(child, &status, 0) < 0 || !WIFSTOPPED(status)) {
+		fprintf(stderr, "ptrace not permitted here\n");
+		return 1;
+	}
+	ptrace(PTRACE_SETOPTIONS, child, NULL,
+		PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+	ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+
+	while ((pid = waitpid(-1, &status, __WALL)) > 0) {
+		int sig = 0;
+
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			if (pid == child)
+				exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+			continue;
+		}
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+			struct ptrace_syscall_info info;
+
+			/* count on entry only, exits come as a separate stop */
+			if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 &&
+			    info.op == PTRACE_SYSCALL_INFO_ENTRY &&
+			    info.entry.nr < NR_SYSCALLS)
+				calls[info.entry.nr]++;
+		} else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) {
+			sig = WSTOPSIG(status);
+		}
+		ptrace(PTRACE_SYSCALL, pid, NULL, sig);
+	}
+	report();
+	return exit_code;
+}
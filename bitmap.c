@@ -16,6 +16,7 @@ This file is taken from the Linux kernel and minimally adapted for use in usersp
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 #include "bitmap.h"
 #include "non-atomic.h"
 
@@ -254,9 +255,10 @@ int __bitmap_intersects(const unsigned long *bitmap1,
 
 #define CHUNKSZ				32
 #define nbits_to_hold_value(val)	fls(val)
-#define unhex(c)			(isdigit(c) ? (c - '0') : (toupper(c) - 'A' + 10))
 #define BASEDEC 10		/* fancier cpuset lists input in decimal */
 
+static const char hex_asc[] = "0123456789abcdef";
+
 /**
  * bitmap_scnprintf - convert bitmap to an ASCII hex string.
  * @buf: byte buffer into which string is placed
@@ -265,18 +267,22 @@ int __bitmap_intersects(const unsigned long *bitmap1,
  * @nmaskbits: size of bitmap, in bits
  *
  * Exactly @nmaskbits bits are displayed.  Hex digits are grouped into
- * comma-separated sets of eight digits per set.
+ * comma-separated sets of eight digits per set.  The digits come from
+ * a nibble table, not stdio; output stops at the last set that fits
+ * and the length written is returned.
  */
 int bitmap_scnprintf(char *buf, unsigned int buflen,
 	const unsigned long *maskp, int nmaskbits)
 {
-	int i, word, bit, len = 0;
+	int i, d, word, bit, ndigits, len = 0;
 	unsigned long val;
-	const char *sep = "";
 	int chunksz;
 	uint32_t chunkmask;
 	int first = 1;
 
+	if (!buflen)
+		return 0;
+
 	chunksz = nmaskbits & (CHUNKSZ - 1);
 	if (chunksz == 0)
 		chunksz = CHUNKSZ;
@@ -288,16 +294,119 @@ int bitmap_scnprintf(char *buf, unsigned int buflen,
 		bit = i % BITS_PER_LONG;
 		val = (maskp[word] >> bit) & chunkmask;
 		if (val!=0 || !first || i==0)  {
-			len += snprintf(buf+len, buflen-len, "%s%0*lx", sep,
-				(chunksz+3)/4, val);
-			sep = ",";
+			ndigits = (chunksz + 3) / 4;
+			if (len + !first + ndigits >= buflen)
+				break;
+			if (!first)
+				buf[len++] = ',';
+			for (d = ndigits - 1; d >= 0; d--)
+				buf[len++] = hex_asc[(val >> (d * 4)) & 0xf];
 			first = 0;
 		}
 		chunksz = CHUNKSZ;
 	}
+	buf[len] = '\0';
+	return len;
+}
+
+/*
+ * bscnl_emit(buf, buflen, rbot, rtop, bp)
+ *
+ * Helper routine for bitmap_scnlistprintf().  Write decimal number
+ * or range to buf, suppressing output past buf+buflen, with optional
+ * comma-prefix.  Return len of what would be written to buf, if it
+ * all fit.
+ */
+static inline int bscnl_emit(char *buf, int buflen, int rbot, int rtop, int len)
+{
+	char tmp[32];
+	int n;
+
+	if (rbot == rtop)
+		n = snprintf(tmp, sizeof(tmp), "%s%d", len ? "," : "", rbot);
+	else
+		n = snprintf(tmp, sizeof(tmp), "%s%d-%d", len ? "," : "", rbot, rtop);
+	if (len < buflen)
+		snprintf(buf + len, buflen - len, "%s", tmp);
+	return len + n;
+}
+
+/**
+ * bitmap_scnlistprintf - convert bitmap to list format ASCII string
+ * @buf: byte buffer into which string is placed
+ * @buflen: reserved size of @buf, in bytes
+ * @maskp: pointer to bitmap to convert
+ * @nmaskbits: size of bitmap, in bits
+ *
+ * Output format is a comma-separated list of decimal numbers and
+ * ranges.  Consecutively set bits are shown as two hyphen-separated
+ * decimal numbers, the smallest and largest bit numbers set in
+ * the range.  Output format is compatible with the format
+ * accepted as input by bitmap_parselist().
+ *
+ * The return value is the number of characters which would be
+ * generated for the given input, excluding the trailing '\0', as
+ * per ISO C99.
+ */
+int bitmap_scnlistprintf(char *buf, unsigned int buflen,
+	const unsigned long *maskp, int nmaskbits)
+{
+	int len = 0;
+	/* current bit is 'cur', most recently seen range is [rbot, rtop] */
+	int cur, rbot, rtop;
+
+	if (buflen == 0)
+		return 0;
+	buf[0] = 0;
+
+	rbot = cur = find_first_bit(maskp, nmaskbits);
+	while (cur < nmaskbits) {
+		rtop = cur;
+		cur = find_next_bit(maskp, nmaskbits, cur+1);
+		if (cur >= nmaskbits || cur > rtop + 1) {
+			len = bscnl_emit(buf, buflen, rbot, rtop, len);
+			rbot = cur;
+		}
+	}
 	return len;
 }
 
+/* Value of a hex digit, 0x10 for anything else */
+static const unsigned char hex_nibble[256] = {
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x00 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x08 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x10 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x18 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x20 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x28 */
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,	/* 0x30 */
+	0x08, 0x09, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x38 */
+	0x10, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,	/* 0x40 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x48 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x50 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x58 */
+	0x10, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,	/* 0x60 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x68 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x70 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x78 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x80 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x88 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x90 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0x98 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xa0 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xa8 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xb0 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xb8 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xc0 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xc8 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xd0 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xd8 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xe0 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xe8 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xf0 */
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,	/* 0xf8 */
+};
+
 /**
  * __bitmap_parse - convert an ASCII hex string into a bitmap.
  * @buf: pointer to buffer containing string.
@@ -313,13 +422,19 @@ int bitmap_scnprintf(char *buf, unsigned int buflen,
  * then leading 0-bits are prepended.  %-EINVAL is returned for illegal
  * characters and for grouping errors such as "1,,5", ",44", "," and "".
  * Leading and trailing whitespace accepted, but not embedded whitespace.
+ *
+ * The string is checked front to back first, then the hex digits of the
+ * accepted chunks are stored from the right-hand end straight into their
+ * words, so the cost is linear in the length of the string rather than
+ * one whole bitmap shift per chunk.
  */
 int __bitmap_parse(const char *buf, unsigned int buflen,
 		int is_user __attribute((unused)), unsigned long *maskp,
 		int nmaskbits)
 {
 	int c, old_c, totaldigits, ndigits, nchunks, nbits;
-	uint32_t chunk;
+	const char *start = buf, *end = buf, *last = buf, *p;
+	uint32_t chunk, val;
 
 	bitmap_zero(maskp, nmaskbits);
 
@@ -338,16 +453,17 @@ int __bitmap_parse(const char *buf, unsigned int buflen,
 			/*
 			 * If the last character was a space and the current
 			 * character isn't '\0', we've got embedded whitespace.
-			 * This is a no-no, so throw an error.
+			 * This is a no-no, so stop at the chunks before it.
 			 */
 			if (totaldigits && c && isspace(old_c))
-				return 0;
+				goto fill;
 
 			/* A '\0' or a ',' signal the end of the chunk */
 			if (c == '\0' || c == ',')
 				break;
 
-			if (!isxdigit(c))
+			val = hex_nibble[(unsigned char)c];
+			if (val > 0xf)
 				return -EINVAL;
 
 			/*
@@ -358,25 +474,165 @@ int __bitmap_parse(const char *buf, unsigned int buflen,
 			if (chunk & ~((1UL << (CHUNKSZ - 4)) - 1))
 				return -EOVERFLOW;
 
-			chunk = (chunk << 4) | unhex(c);
+			chunk = (chunk << 4) | val;
 			ndigits++; totaldigits++;
+			last = buf;
 		}
 		if (ndigits == 0)
 			return -EINVAL;
+		end = last;
 		if (nchunks == 0 && chunk == 0)
 			continue;
 
-		__bitmap_shift_left(maskp, maskp, CHUNKSZ, nmaskbits);
-		*maskp |= chunk;
 		nchunks++;
 		nbits += (nchunks == 1) ? nbits_to_hold_value(chunk) : CHUNKSZ;
 		if (nbits > nmaskbits)
 			return -EOVERFLOW;
 	} while (buflen && c == ',');
 
+fill:
+	/*
+	 * Only digits, commas and the leading whitespace are left before
+	 * @end, and nbits kept every set bit below nmaskbits.  Leading zero
+	 * digits and chunks, which may lie past nmaskbits, store nothing.
+	 */
+	nbits = ndigits = 0;
+	chunk = 0;
+	for (p = end; p-- > start;) {
+		c = *p;
+		if (c != ',') {
+			val = hex_nibble[(unsigned char)c];
+			if (val < 0x10 && ndigits < CHUNKSZ / 4)
+				chunk |= val << (ndigits++ * 4);
+			if (p > start)
+				continue;
+		}
+		if (chunk)
+			maskp[nbits / BITS_PER_LONG] |=
+				(unsigned long)chunk << (nbits % BITS_PER_LONG);
+		nbits += CHUNKSZ;
+		ndigits = 0;
+		chunk = 0;
+	}
 	return 0;
 }
 
+/**
+ * __bitmap_set - set a run of bits
+ * @map: bitmap to write
+ * @start: first bit to set
+ * @len: number of bits to set
+ *
+ * Whole words in the middle are stored at once, the partial first and
+ * last words through BITMAP_FIRST_WORD_MASK/BITMAP_LAST_WORD_MASK.
+ */
+void __bitmap_set(unsigned long *map, unsigned int start, int len)
+{
+	unsigned long *p = map + start / BITS_PER_LONG;
+	const unsigned int size = start + len;
+	int bits_to_set = BITS_PER_LONG - (start % BITS_PER_LONG);
+	unsigned long mask_to_set = BITMAP_FIRST_WORD_MASK(start);
+
+	while (len - bits_to_set >= 0) {
+		*p |= mask_to_set;
+		len -= bits_to_set;
+		bits_to_set = BITS_PER_LONG;
+		mask_to_set = ~0UL;
+		p++;
+	}
+	if (len) {
+		mask_to_set &= BITMAP_LAST_WORD_MASK(size);
+		*p |= mask_to_set;
+	}
+}
+
+/* One "start-end:used/group_len" region of a cpulist */
+struct region {
+	unsigned int start;
+	unsigned int end;
+	unsigned int used;
+	unsigned int group_len;
+};
+
+#define end_of_str(p, end)	((p) == (end) || *(p) == '\0')
+#define end_of_region(p, end)	(end_of_str(p, end) || *(p) == ',' || isspace(*(p)))
+#define is_digit(c)		((unsigned char)((c) - '0') < 10)
+
+/* A decimal number, or "N" for the last bit */
+static const char *parselist_num(const char *p, const char *end,
+		unsigned int lastbit, unsigned int *num, int *err)
+{
+	unsigned long long n = 0;
+
+	if (!end_of_str(p, end) && *p == 'N') {
+		*num = lastbit;
+		return p + 1;
+	}
+	if (end_of_str(p, end) || !is_digit(*p)) {
+		*err = -EINVAL;
+		return NULL;
+	}
+	for (; p != end && is_digit(*p); p++) {
+		n = n * 10 + (*p - '0');
+		if (n > UINT_MAX) {
+			*err = -EOVERFLOW;
+			return NULL;
+		}
+	}
+	*num = n;
+	return p;
+}
+
+/* Parse the region at @p into @r, returns the first byte past it */
+static const char *parselist_region(const char *p, const char *end,
+		struct region *r, unsigned int lastbit, int *err)
+{
+	if (*p == 'a' && end - p >= 3 && !strncmp(p, "all", 3)) {
+		r->start = 0;
+		r->end = lastbit;
+		p += 3;
+		goto check_pattern;
+	}
+
+	p = parselist_num(p, end, lastbit, &r->start, err);
+	if (!p)
+		return NULL;
+	if (end_of_region(p, end)) {
+		r->end = r->start;
+		goto no_pattern;
+	}
+	if (*p != '-')
+		goto inval;
+	p = parselist_num(p + 1, end, lastbit, &r->end, err);
+	if (!p)
+		return NULL;
+
+check_pattern:
+	if (end_of_region(p, end))
+		goto no_pattern;
+	if (*p != ':')
+		goto inval;
+	p = parselist_num(p + 1, end, lastbit, &r->used, err);
+	if (!p)
+		return NULL;
+	if (end_of_str(p, end) || *p != '/')
+		goto inval;
+	p = parselist_num(p + 1, end, lastbit, &r->group_len, err);
+	if (!p)
+		return NULL;
+	if (!end_of_region(p, end))
+		goto inval;
+	return p;
+
+no_pattern:
+	r->used = r->end + 1;
+	r->group_len = r->end + 1;
+	return p;
+inval:
+	*err = -EINVAL;
+	return NULL;
+}
+
 /**
  * __bitmap_parselist - convert list format ASCII string to bitmap
  * @buf: read nul-terminated user string from this buffer
@@ -390,75 +646,77 @@ int __bitmap_parse(const char *buf, unsigned int buflen,
  * ranges.  Consecutively set bits are shown as two hyphen-separated
  * decimal numbers, the smallest and largest bit numbers set in
  * the range.
+ * Optionally each range can be postfixed to denote that only parts of it
+ * should be set.  The range will divided to groups of specific size.
+ * From each group will be used only defined amount of bits.
+ * Syntax: range:used_size/group_size
+ * Example: 0-1023:2/256 ==> 0,1,256,257,512,513,768,769
+ * The value 'N' can be used as a dynamically substituted token for the
+ * maximum allowed value; i.e (nmaskbits - 1).  Keep in mind that it is
+ * dynamic, so if system changes cause the bitmap width to change, such
+ * as more cores in a CPU list, then any ranges using N will also change.
+ * "all" stands for "0-N".  Whitespace separates regions like a comma,
+ * and an empty string is an empty mask.
+ *
+ * Each run of a region is set a word at a time by bitmap_set().
  *
  * Returns 0 on success, -errno on invalid input strings.
  * Error values:
- *    %-EINVAL: second number in range smaller than first
+ *    %-EINVAL: wrong region format
  *    %-EINVAL: invalid character in string
+ *    %-EINVAL: second number in range smaller than first
+ *    %-EINVAL: group_size is 0, or used_size > group_size
  *    %-ERANGE: bit number specified too large for mask
+ *    %-EOVERFLOW: integer overflow in the input parameters
  */
 int __bitmap_parselist(const char *buf, unsigned int buflen,
 		int is_user __attribute((unused)), unsigned long *maskp,
 		int nmaskbits)
 {
-	int a, b, c, old_c, totaldigits;
-	int exp_digit, in_range;
+	const char *end = buf + buflen;
+	unsigned int start;
+	struct region r;
+	int err = 0;
 
-	totaldigits = c = 0;
 	bitmap_zero(maskp, nmaskbits);
-	do {
-		exp_digit = 1;
-		in_range = 0;
-		a = b = 0;
-
-		/* Get the next cpu# or a range of cpu#'s */
-		while (buflen) {
-			old_c = c;
-			c = *buf++;
-			buflen--;
-			if (isspace(c))
-				continue;
-
-			/*
-			 * If the last character was a space and the current
-			 * character isn't '\0', we've got embedded whitespace.
-			 * This is a no-no, so throw an error.
-			 */
-			if (totaldigits && c && isspace(old_c))
-				return -EINVAL;
-
-			/* A '\0' or a ',' signal the end of a cpu# or range */
-			if (c == '\0' || c == ',')
-				break;
+	while (1) {
+		/* skip to the next region */
+		while (!end_of_str(buf, end) && (*buf == ',' || isspace(*buf)))
+			buf++;
+		if (end_of_str(buf, end))
+			return 0;
 
-			if (c == '-') {
-				if (exp_digit || in_range)
-					return -EINVAL;
-				b = 0;
-				in_range = 1;
-				exp_digit = 1;
+		/* a lone cpu, the bulk of a sparse list, is set directly */
+		if (is_digit(*buf)) {
+			const char *p = buf;
+			unsigned int bit = 0;
+
+			while (p != end && is_digit(*p) && bit < UINT_MAX / 10)
+				bit = bit * 10 + (*p++ - '0');
+			if (end_of_region(p, end)) {
+				if (bit >= (unsigned int)nmaskbits)
+					return -ERANGE;
+				set_bit(bit, maskp);
+				buf = p;
 				continue;
 			}
-
-			if (!isdigit(c))
-				return -EINVAL;
-
-			b = b * 10 + (c - '0');
-			if (!in_range)
-				a = b;
-			exp_digit = 0;
-			totaldigits++;
 		}
-		if (!(a <= b))
+
+		buf = parselist_region(buf, end, &r, nmaskbits - 1, &err);
+		if (!buf)
+			return err;
+		if (r.start > r.end || r.group_len == 0 || r.used > r.group_len)
 			return -EINVAL;
-		if (b >= nmaskbits)
+		if (r.end >= nmaskbits)
 			return -ERANGE;
-		while (a <= b) {
-			set_bit(a, maskp);
-			a++;
+
+		for (start = r.start; start <= r.end; start += r.group_len) {
+			bitmap_set(maskp, start, min(r.end - start + 1, r.used));
+			/* a group_len past the end must not wrap start */
+			if (r.end - start < r.group_len)
+				break;
 		}
-	} while (buflen && c == ',');
-	return 0;
+	}
 }
 
 /*
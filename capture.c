@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "system_monitor.h"
+#include "capture.h"
+
+/*
+ * Capture file: a header, then records appended tick after tick.  Integers
+ * are host endian, a capture is replayed on the machine type it came from.
+ *
+ *   header	"SMCAP1\n\0" u32 nr_cpus u32 0
+ *   'T'	u64 CLOCK_REALTIME ns, starts a tick
+ *   'P'	u32 id u32 len path, first use of a path in this session
+ *   'D'	u32 id u32 len bytes, raw content of one read
+ *
+ * Another recording appended to the same file starts its ids over with
+ * new 'P' records.
+ */
+#define CAPTURE_MAGIC		"SMCAP1\n"
+#define CAPTURE_MAGIC_LEN	8
+#define REC_TICK		'T'
+#define REC_PATH		'P'
+#define REC_DATA		'D'
+#define CAPTURE_BUF_SIZE	8192
+
+static unsigned int capture_hash(const char *path)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*path) {
+		hash ^= (unsigned char)*path++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static Capture_path_t *capture_slot(Capture_path_t *hash, unsigned int size,
+					const char *path)
+{
+	unsigned int i = capture_hash(path) & (size - 1);
+
+	while (hash[i].path && strcmp(hash[i].path, path))
+		i = (i + 1) & (size - 1);
+	return &hash[i];
+}
+
+static int capture_rehash(Capture_t *cap)
+{
+	unsigned int size = cap->hash_size ? cap->hash_size * 2 : 1024;
+	Capture_path_t *hash;
+	int i;
+
+	hash = (Capture_path_t *)calloc(size, sizeof(Capture_path_t));
+	if (!hash)
+		return -ENOMEM;
+	for (i = 0; i < cap->hash_size; i++)
+		if (cap->hash[i].path)
+			*capture_slot(hash, size, cap->hash[i].path) = cap->hash[i];
+	free(cap->hash);
+	cap->hash = hash;
+	cap->hash_size = size;
+	return 0;
+}
+
+static int capture_grow_ids(Capture_t *cap, unsigned int id)
+{
+	unsigned int nr = cap->max_ids ? cap->max_ids : 256;
+	char **paths;
+	int *defined, *head;
+	int i;
+
+	if (id < cap->max_ids)
+		return 0;
+	while (nr <= id)
+		nr *= 2;
+	paths = realloc(cap->paths, nr * sizeof(char *));
+	if (paths)
+		cap->paths = paths;
+	defined = realloc(cap->defined, nr * sizeof(int));
+	if (defined)
+		cap->defined = defined;
+	head = realloc(cap->head, nr * sizeof(int));
+	if (head)
+		cap->head = head;
+	if (!paths || !defined || !head)
+		return -ENOMEM;
+	for (i = cap->max_ids; i < nr; i++) {
+		cap->paths[i] = NULL;
+		cap->defined[i] = 0;
+		cap->head[i] = -1;
+	}
+	cap->max_ids = nr;
+	return 0;
+}
+
+/* Bind @id to @path, a replayed session may reuse an id for another path */
+static int capture_set_path(Capture_t *cap, unsigned int id, const char *path)
+{
+	Capture_path_t *slot;
+
+	if ((cap->nr_hash + 1) * 2 > cap->hash_size && capture_rehash(cap) < 0)
+		return -ENOMEM;
+	if (capture_grow_ids(cap, id) < 0)
+		return -ENOMEM;
+
+	slot = capture_slot(cap->hash, cap->hash_size, path);
+	if (!slot->path) {
+		slot->path = strdup(path);
+		if (!slot->path)
+			return -ENOMEM;
+		cap->nr_hash++;
+	}
+	slot->id = id;
+	cap->paths[id] = slot->path;
+	if (id >= cap->nr_paths)
+		cap->nr_paths = id + 1;
+	return 0;
+}
+
+static int capture_lookup(const Capture_t *cap, const char *path)
+{
+	const Capture_path_t *slot;
+
+	if (!cap->hash_size)
+		return -1;
+	slot = capture_slot(cap->hash, cap->hash_size, path);
+	/* a stale binding of an id that was redefined since */
+	if (!slot->path || cap->paths[slot->id] != slot->path)
+		return -1;
+	return slot->id;
+}
+
+static int capture_put(Capture_t *cap, int type, unsigned int id,
+			const char *data, size_t len)
+{
+	uint32_t hdr[2] = { id, len };
+
+	if (fputc(type, cap->file) == EOF ||
+	    fwrite(hdr, sizeof(hdr), 1, cap->file) != 1 ||
+	    (len && fwrite(data, len, 1, cap->file) != 1))
+		return -EIO;
+	return 0;
+}
+
+static void capture_record(Capture_t *cap, const char *path,
+				const char *data, size_t len)
+{
+	int id = capture_lookup(cap, path);
+
+	if (id < 0) {
+		id = cap->nr_paths;
+		if (capture_set_path(cap, id, path) < 0)
+			return;
+	}
+	if (!cap->defined[id]) {
+		if (capture_put(cap, REC_PATH, id, path, strlen(path)) < 0)
+			return;
+		cap->defined[id] = 1;
+	}
+	capture_put(cap, REC_DATA, id, data, len);
+}
+
+/* Next unread bytes of @path in the replayed tick */
+static ssize_t capture_replay_read(Capture_t *cap, const char *path, char **data)
+{
+	int id = capture_lookup(cap, path);
+	Capture_rec_t *rec;
+
+	if (id < 0 || cap->head[id] < 0)
+		return -ENOENT;
+	rec = &cap->recs[cap->head[id]];
+	cap->head[id] = rec->next;
+	*data = cap->data + rec->off;
+	return rec->len;
+}
+
+static int capture_reserve(char **buf, size_t *size, size_t len)
+{
+	size_t new_size = *size ? *size : CAPTURE_BUF_SIZE;
+	char *new_buf;
+
+	if (len < *size)
+		return 0;
+	while (len >= new_size)
+		new_size *= 2;
+	new_buf = realloc(*buf, new_size);
+	if (!new_buf)
+		return -ENOMEM;
+	*buf = new_buf;
+	*size = new_size;
+	return 0;
+}
+
+ssize_t capture_read(Capture_t *cap, const char *path, char **data)
+{
+	char full[PATH_MAX];
+	size_t len = 0;
+	ssize_t nread;
+	int fd;
+
+	if (cap->mode == CAPTURE_REPLAY)
+		return capture_replay_read(cap, path, data);
+
+	root_path(full, PATH_MAX, "%s", path);
+	fd = open(full, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	for (;;) {
+		if (capture_reserve(&cap->buf, &cap->size, len + 1) < 0) {
+			close(fd);
+			return -ENOMEM;
+		}
+		nread = read(fd, cap->buf + len, cap->size - 1 - len);
+		if (nread <= 0)
+			break;
+		len += nread;
+	}
+	if (nread < 0) {
+		nread = -errno;
+		close(fd);
+		return nread;
+	}
+	close(fd);
+	cap->buf[len] = '\0';
+
+	if (cap->mode == CAPTURE_RECORD)
+		capture_record(cap, path, cap->buf, len);
+	*data = cap->buf;
+	return len;
+}
+
+/* Layout getdents64() fills in, glibc's struct dirent may differ */
+struct linux_dirent64 {
+	uint64_t	d_ino;
+	int64_t		d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char		d_name[];
+};
+
+/*
+ * Entry names of directory @path, one per line, hidden ones skipped.
+ * getdents64() straight into a stack buffer, opendir() would malloc a DIR
+ * on every tick.
+ */
+ssize_t capture_list(Capture_t *cap, const char *path, char **data)
+{
+	char full[PATH_MAX], dents[CAPTURE_BUF_SIZE];
+	struct linux_dirent64 *entry;
+	size_t len = 0;
+	long nread;
+	long off;
+	int fd;
+
+	if (cap->mode == CAPTURE_REPLAY)
+		return capture_replay_read(cap, path, data);
+
+	root_path(full, PATH_MAX, "%s", path);
+	fd = open(full, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (capture_reserve(&cap->list, &cap->list_size, 1) < 0) {
+		close(fd);
+		return -ENOMEM;
+	}
+	while ((nread = syscall(SYS_getdents64, fd, dents, sizeof(dents))) > 0) {
+		for (off = 0; off < nread; off += entry->d_reclen) {
+			size_t nlen;
+
+			entry = (struct linux_dirent64 *)(dents + off);
+			if (entry->d_name[0] == '.')
+				continue;
+			nlen = strlen(entry->d_name);
+			if (capture_reserve(&cap->list, &cap->list_size,
+						len + nlen + 2) < 0) {
+				close(fd);
+				return -ENOMEM;
+			}
+			memcpy(cap->list + len, entry->d_name, nlen);
+			len += nlen;
+			cap->list[len++] = '\n';
+		}
+	}
+	if (nread < 0) {
+		nread = -errno;
+		close(fd);
+		return nread;
+	}
+	close(fd);
+	cap->list[len] = '\0';
+
+	if (cap->mode == CAPTURE_RECORD)
+		capture_record(cap, path, cap->list, len);
+	*data = cap->list;
+	return len;
+}
+
+static int capture_load_data(Capture_t *cap, unsigned int id, size_t len)
+{
+	Capture_rec_t *rec;
+
+	if (id >= cap->nr_paths || !cap->paths[id])
+		return -EINVAL;
+	if (cap->nr_recs == cap->max_recs) {
+		unsigned int nr = cap->max_recs ? cap->max_recs * 2 : 1024;
+		Capture_rec_t *recs = realloc(cap->recs, nr * sizeof(Capture_rec_t));
+
+		if (!recs)
+			return -ENOMEM;
+		cap->recs = recs;
+		cap->max_recs = nr;
+	}
+	if (capture_reserve(&cap->data, &cap->data_size, cap->data_len + len + 1) < 0)
+		return -ENOMEM;
+	if (len && fread(cap->data + cap->data_len, len, 1, cap->file) != 1)
+		return -EIO;
+
+	rec = &cap->recs[cap->nr_recs++];
+	rec->id = id;
+	rec->off = cap->data_len;
+	rec->len = len;
+	cap->data_len += len;
+	cap->data[cap->data_len++] = '\0';
+	return 0;
+}
+
+/* Read the records of the next tick; -ENODATA at the end of the capture */
+static int capture_load_tick(Capture_t *cap)
+{
+	char path[PATH_MAX];
+	uint32_t hdr[2];
+	uint64_t ns;
+	int seen_tick = 0;
+	int type, ret;
+	int i;
+
+	for (i = 0; i < cap->nr_recs; i++)
+		cap->head[cap->recs[i].id] = -1;
+	cap->nr_recs = 0;
+	cap->data_len = 0;
+
+	while ((type = fgetc(cap->file)) != EOF) {
+		if (type == REC_TICK) {
+			if (seen_tick) {
+				ungetc(type, cap->file);
+				break;
+			}
+			if (fread(&ns, sizeof(ns), 1, cap->file) != 1)
+				return -EIO;
+			cap->tick_ns = ns;
+			seen_tick = 1;
+			continue;
+		}
+		if ((type != REC_PATH && type != REC_DATA) ||
+		    fread(hdr, sizeof(hdr), 1, cap->file) != 1) {
+			printf("corrupt capture record\n");
+			return -EINVAL;
+		}
+		if (type == REC_PATH) {
+			if (hdr[1] >= PATH_MAX ||
+			    fread(path, hdr[1], 1, cap->file) != 1)
+				return -EIO;
+			path[hdr[1]] = '\0';
+			ret = capture_set_path(cap, hdr[0], path);
+		} else {
+			ret = capture_load_data(cap, hdr[0], hdr[1]);
+		}
+		if (ret < 0)
+			return ret;
+	}
+	if (!seen_tick)
+		return -ENODATA;
+
+	/* reads of one path are served in the order they were taken */
+	for (i = cap->nr_recs - 1; i >= 0; i--) {
+		cap->recs[i].next = cap->head[cap->recs[i].id];
+		cap->head[cap->recs[i].id] = i;
+	}
+	return 0;
+}
+
+int capture_tick(Capture_t *cap)
+{
+	struct timespec ts;
+	uint64_t ns;
+
+	switch (cap->mode) {
+	case CAPTURE_RECORD:
+		/* the previous tick is complete, keep it across a crash */
+		fflush(cap->file);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ns = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+		cap->tick_ns = ns;
+		if (fputc(REC_TICK, cap->file) == EOF ||
+		    fwrite(&ns, sizeof(ns), 1, cap->file) != 1)
+			return -EIO;
+		return 0;
+	case CAPTURE_REPLAY:
+		return capture_load_tick(cap);
+	default:
+		return 0;
+	}
+}
+
+int init_capture(Capture_t *cap, int mode, const char *dir, unsigned int nr_cpus)
+{
+	char path[PATH_MAX];
+	char magic[CAPTURE_MAGIC_LEN];
+	uint32_t hdr[2];
+
+	memset(cap, 0, sizeof(*cap));
+	cap->mode = mode;
+	if (mode == CAPTURE_OFF)
+		return 0;
+
+	if (mode == CAPTURE_RECORD && mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		printf("create %s failed:%s\n", dir, strerror(errno));
+		return -errno;
+	}
+	snprintf(path, PATH_MAX, "%s/" CAPTURE_FILE, dir);
+	cap->file = fopen(path, mode == CAPTURE_RECORD ? "a+b" : "rb");
+	if (!cap->file) {
+		printf("open %s failed:%s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	/* an empty file gets the header, otherwise it must match */
+	if (fread(magic, sizeof(magic), 1, cap->file) != 1 ||
+	    fread(hdr, sizeof(hdr), 1, cap->file) != 1) {
+		if (mode == CAPTURE_REPLAY || ftell(cap->file) != 0) {
+			printf("%s is not a capture\n", path);
+			return -EINVAL;
+		}
+		memset(magic, 0, sizeof(magic));
+		memcpy(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC));
+		hdr[0] = nr_cpus;
+		hdr[1] = 0;
+		fwrite(magic, sizeof(magic), 1, cap->file);
+		fwrite(hdr, sizeof(hdr), 1, cap->file);
+	} else if (memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC))) {
+		printf("%s is not a capture\n", path);
+		return -EINVAL;
+	} else if (mode == CAPTURE_RECORD && hdr[0] != nr_cpus) {
+		printf("%s was taken with %u cpus, not %u\n", path, hdr[0], nr_cpus);
+		return -EINVAL;
+	}
+	cap->nr_cpus = mode == CAPTURE_REPLAY ? hdr[0] : nr_cpus;
+	return 0;
+}
+
+void destroy_capture(Capture_t *cap)
+{
+	int i;
+
+	if (cap->file)
+		fclose(cap->file);
+	for (i = 0; i < cap->hash_size; i++)
+		free(cap->hash[i].path);
+	free(cap->hash);
+	free(cap->paths);
+	free(cap->defined);
+	free(cap->head);
+	free(cap->buf);
+	free(cap->list);
+	free(cap->recs);
+	free(cap->data);
+	memset(cap, 0, sizeof(*cap));
+}
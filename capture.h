@@ -0,0 +1,57 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#define CAPTURE_FILE	"capture.smr"	//file name inside the --record dir
+
+enum capture_mode {
+	CAPTURE_OFF = 0,	//plain reads of the live files
+	CAPTURE_RECORD,		//live reads, raw bytes appended to the capture
+	CAPTURE_REPLAY,		//reads served from the capture
+};
+
+/* One path read of the tick being replayed */
+typedef struct capture_rec {
+	unsigned int	id;
+	size_t		off;		//bytes at Capture_t.data + off
+	size_t		len;
+	int		next;		//next read of the same id, -1 for none
+}Capture_rec_t;
+
+typedef struct capture_path {
+	char		*path;
+	unsigned int	id;
+}Capture_path_t;
+
+typedef struct capture {
+	int		mode;
+	FILE		*file;
+	unsigned int	nr_cpus;
+	unsigned long long tick_ns;	//CLOCK_REALTIME of the tick
+	/* path <-> id, ids are per recording session */
+	Capture_path_t	*hash;		//open addressing, hash_size slots
+	unsigned int	hash_size;
+	unsigned int	nr_hash;
+	char		**paths;	//id -> path
+	unsigned int	nr_paths, max_ids;
+	int		*defined;	//id written in this session (record)
+	/* live read buffers, a listing stays valid across reads */
+	char		*buf, *list;
+	size_t		size, list_size;
+	/* reads of the replayed tick */
+	Capture_rec_t	*recs;
+	unsigned int	nr_recs, max_recs;
+	int		*head;		//id -> first unread rec
+	char		*data;
+	size_t		data_len, data_size;
+}Capture_t;
+
+int init_capture(Capture_t *cap, int mode, const char *dir, unsigned int nr_cpus);
+int capture_tick(Capture_t *cap);
+ssize_t capture_read(Capture_t *cap, const char *path, char **data);
+ssize_t capture_list(Capture_t *cap, const char *path, char **data);
+void destroy_capture(Capture_t *cap);
+
+#endif
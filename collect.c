@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "collect.h"
+
+/* Items [*first, *last) of @shard, shard sizes differ by one at most */
+static void collect_shard(const Collect_t *col, unsigned int shard,
+			unsigned int *first, unsigned int *last)
+{
+	*first = (unsigned long long)col->nr_items * shard / col->nr_threads;
+	*last = (unsigned long long)col->nr_items * (shard + 1) / col->nr_threads;
+}
+
+static void *collect_worker(void *arg)
+{
+	Collect_worker_t *worker = arg;
+	Collect_t *col = worker->col;
+	unsigned int first, last;
+
+	/* nr_threads and the barriers are final once the lock is released */
+	pthread_mutex_lock(&col->lock);
+	pthread_mutex_unlock(&col->lock);
+
+	collect_shard(col, worker->shard, &first, &last);
+	for (;;) {
+		pthread_barrier_wait(&col->start);
+		if (col->stop)
+			break;
+		col->fn(first, last, col->data);
+		pthread_barrier_wait(&col->done);
+	}
+	return NULL;
+}
+
+int init_collect(Collect_t *col, unsigned int nr_threads, unsigned int nr_items,
+		void (*fn)(unsigned int first, unsigned int last, void *data),
+		void *data)
+{
+	unsigned int i;
+	int ret;
+
+	memset(col, 0, sizeof(*col));
+	if (!nr_threads || nr_threads > COLLECT_MAX_THREADS)
+		return -EINVAL;
+	if (nr_threads > nr_items)
+		nr_threads = nr_items ? nr_items : 1;
+	col->nr_threads = 1;
+	col->nr_items = nr_items;
+	col->fn = fn;
+	col->data = data;
+	if (nr_threads == 1)
+		return 0;
+
+	col->workers = (Collect_worker_t *)calloc(nr_threads,
+						sizeof(Collect_worker_t));
+	if (!col->workers) {
+		printf("alloc mem for collect threads failed\n");
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&col->lock, NULL);
+	pthread_mutex_lock(&col->lock);
+	for (i = 1; i < nr_threads; i++) {
+		col->workers[i].col = col;
+		col->workers[i].shard = i;
+		ret = pthread_create(&col->workers[i].thread, NULL,
+					collect_worker, &col->workers[i]);
+		if (ret) {
+			/* run with the workers that did start */
+			printf("create collect thread failed:%s\n", strerror(ret));
+			break;
+		}
+		col->nr_threads++;
+	}
+	pthread_barrier_init(&col->start, NULL, col->nr_threads);
+	pthread_barrier_init(&col->done, NULL, col->nr_threads);
+	pthread_mutex_unlock(&col->lock);
+	return 0;
+}
+
+/* Run every shard, return once all of them are done */
+void collect_run(Collect_t *col)
+{
+	unsigned int first, last;
+
+	if (col->nr_threads == 1) {
+		col->fn(0, col->nr_items, col->data);
+		return;
+	}
+	pthread_barrier_wait(&col->start);
+	collect_shard(col, 0, &first, &last);
+	col->fn(first, last, col->data);
+	pthread_barrier_wait(&col->done);
+}
+
+void destroy_collect(Collect_t *col)
+{
+	unsigned int i;
+
+	if (col->workers) {
+		if (col->nr_threads > 1) {
+			col->stop = 1;
+			pthread_barrier_wait(&col->start);
+			for (i = 1; i < col->nr_threads; i++)
+				pthread_join(col->workers[i].thread, NULL);
+		}
+		pthread_barrier_destroy(&col->start);
+		pthread_barrier_destroy(&col->done);
+		pthread_mutex_destroy(&col->lock);
+		free(col->workers);
+	}
+	memset(col, 0, sizeof(*col));
+}
@@ -0,0 +1,40 @@
+#ifndef _COLLECT_H_
+#define _COLLECT_H_
+
+#include <pthread.h>
+
+#define COLLECT_MAX_THREADS	64
+
+struct collect;
+
+typedef struct collect_worker {
+	struct collect	*col;
+	unsigned int	shard;
+	pthread_t	thread;
+}Collect_worker_t;
+
+/*
+ * Worker threads that split a per cpu collection stage into shards of
+ * contiguous cpus.  The calling thread runs shard 0 itself, so one
+ * thread means no workers at all.  Neighbouring shards share the mask
+ * word at their boundary: a shard function setting bits of a shared
+ * mask uses an atomic_cpumask_t, not cpu_set() on a cpumask_t.
+ */
+typedef struct collect {
+	unsigned int	nr_threads;
+	unsigned int	nr_items;	//cpus split across the shards
+	void		(*fn)(unsigned int first, unsigned int last, void *data);
+	void		*data;
+	Collect_worker_t *workers;	//[0] is unused, shard 0 is the caller
+	pthread_mutex_t	lock;		//held until every worker is up
+	pthread_barrier_t start, done;	//around every collect_run()
+	int		stop;
+}Collect_t;
+
+int init_collect(Collect_t *col, unsigned int nr_threads, unsigned int nr_items,
+		void (*fn)(unsigned int first, unsigned int last, void *data),
+		void *data);
+void collect_run(Collect_t *col);
+void destroy_collect(Collect_t *col);
+
+#endif
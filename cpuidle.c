@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "cpumask.h"
+#include "system_monitor.h"
+#include "cpuidle.h"
+
+#define CPUIDLE_STATE_PATH	CPU_PATH "/cpu%d/cpuidle/state%d"
+
+static void get_name(char *line, void *data)
+{
+	char *name = (char *)data;
+
+	snprintf(name, CPUIDLE_NAME_LEN, "%s", line);
+	name[strcspn(name, "\n")] = '\0';
+}
+
+static void get_uint(char *line, void *data)
+{
+	unsigned int *val = (unsigned int *)data;
+	*val = strtoul(line, NULL, 10);
+}
+
+static int cpuidle_count_states(int cpu)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int nr = 0;
+
+	for (;;) {
+		root_path(path, PATH_MAX, CPUIDLE_STATE_PATH, cpu, nr);
+		if (stat(path, &st) < 0)
+			break;
+		nr++;
+	}
+	return nr;
+}
+
+static int cpuidle_open_state(int cpu, int state, const char *attr)
+{
+	char path[PATH_MAX];
+
+	root_path(path, PATH_MAX, CPUIDLE_STATE_PATH "/%s", cpu, state, attr);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static int cpuidle_read_counter(int fd, int cpu, int state, const char *attr,
+				unsigned long long *val)
+{
+	char buf[32];
+	ssize_t nread;
+	int tmp_fd = -1;
+
+	if (fd < 0) {
+		tmp_fd = fd = cpuidle_open_state(cpu, state, attr);
+		if (fd < 0)
+			return -errno;
+	}
+	nread = pread_one_line(fd, buf, sizeof(buf));
+	if (tmp_fd >= 0)
+		close(tmp_fd);
+	if (nread <= 0)
+		return -EINVAL;
+
+	*val = strtoull(buf, NULL, 10);
+	return 0;
+}
+
+int init_cpuidle(Cpuidle_t *idle, unsigned int nr_cpus)
+{
+	char path[PATH_MAX];
+	int cpu, i, nr;
+
+	memset(idle, 0, sizeof(*idle));
+	idle->nr_cpus = nr_cpus;
+	idle->cpus = (Cpuidle_cpu_t *)calloc(nr_cpus, sizeof(Cpuidle_cpu_t));
+	if (!idle->cpus) {
+		printf("alloc mem for cpuidle failed\n");
+		return -ENOMEM;
+	}
+
+	/* The state list is discovered once, sampling never walks sysfs */
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		idle->cpus[cpu].nr_states = cpuidle_count_states(cpu);
+		idle->nr_states += idle->cpus[cpu].nr_states;
+	}
+	if (!idle->nr_states) {
+		printf("Need to support cpuidle driver\n");
+		return -ENOENT;
+	}
+
+	idle->states = (Cpuidle_state_t *)calloc(idle->nr_states,
+						sizeof(Cpuidle_state_t));
+	if (!idle->states) {
+		printf("alloc mem for cpuidle failed\n");
+		idle->nr_states = 0;
+		return -ENOMEM;
+	}
+
+	/* Each state keeps two descriptors open */
+	raise_nofile_limit();
+
+	nr = 0;
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		Cpuidle_cpu_t *c = &idle->cpus[cpu];
+
+		c->states = &idle->states[nr];
+		nr += c->nr_states;
+		for (i = 0; i < c->nr_states; i++) {
+			Cpuidle_state_t *state = &c->states[i];
+
+			root_path(path, PATH_MAX, CPUIDLE_STATE_PATH "/name", cpu, i);
+			if (process_one_line(path, get_name, state->name) < 0)
+				snprintf(state->name, CPUIDLE_NAME_LEN, "state%d", i);
+			root_path(path, PATH_MAX, CPUIDLE_STATE_PATH "/latency", cpu, i);
+			if (process_one_line(path, get_uint, &state->latency) < 0)
+				state->latency = 0;
+			state->time_fd = cpuidle_open_state(cpu, i, "time");
+			state->usage_fd = cpuidle_open_state(cpu, i, "usage");
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Sample time/usage of every state of the online cpus and turn the deltas
+ * into residency, wakeup latency and the us precision busy share (time
+ * in no state) for the elapsed interval.
+ */
+void cpuidle_sample(Cpuidle_t *idle)
+{
+	unsigned long long now, elapsed_us;
+	int cpu, i;
+
+	now = monotonic_ns();
+	elapsed_us = idle->last_ns ? (now - idle->last_ns) / NSEC_PER_USEC : 0;
+	idle->last_ns = now;
+
+	for_each_online_cpu(cpu) {
+		Cpuidle_cpu_t *c;
+		unsigned long long wakeups = 0, latency_us = 0, idle_us = 0;
+		int valid = 1;
+
+		if (cpu >= idle->nr_cpus)
+			break;
+		c = &idle->cpus[cpu];
+
+		for (i = 0; i < c->nr_states; i++) {
+			Cpuidle_state_t *state = &c->states[i];
+			unsigned long long dtime, dusage;
+
+			state->prev_time = state->time;
+			state->prev_usage = state->usage;
+			if (cpuidle_read_counter(state->time_fd, cpu, i, "time",
+						&state->time) < 0 ||
+			    cpuidle_read_counter(state->usage_fd, cpu, i, "usage",
+						&state->usage) < 0) {
+				state->residency = 0;
+				valid = 0;
+				continue;
+			}
+
+			/* Counters restart when a cpu is hotplugged */
+			if (!elapsed_us || state->time < state->prev_time ||
+			    state->usage < state->prev_usage) {
+				state->residency = 0;
+				valid = 0;
+				continue;
+			}
+			dtime = state->time - state->prev_time;
+			idle_us += dtime;
+			dusage = state->usage - state->prev_usage;
+			state->residency = dtime >= elapsed_us ? 1000 :
+					(unsigned int)(1000 * dtime / elapsed_us);
+			wakeups += dusage;
+			latency_us += dusage * state->latency;
+		}
+
+		/*
+		 * time only moves when a cpu leaves a state, so with no
+		 * wakeup the cpu slept or ran through and the share is unknown
+		 */
+		if (!valid || !c->nr_states || !wakeups)
+			c->busy = -1;
+		else
+			c->busy = idle_us >= elapsed_us ? 0 :
+				1000 - (int)(1000 * idle_us / elapsed_us);
+		c->wake_latency = wakeups ? (unsigned int)(latency_us / wakeups) : 0;
+		if (!elapsed_us)
+			c->wake_exposure = 0;
+		else
+			c->wake_exposure = latency_us >= elapsed_us ? 1000 :
+				(unsigned int)(1000 * latency_us / elapsed_us);
+	}
+}
+
+void destroy_cpuidle(Cpuidle_t *idle)
+{
+	int i;
+
+	for (i = 0; i < idle->nr_states; i++) {
+		if (idle->states[i].time_fd >= 0)
+			close(idle->states[i].time_fd);
+		if (idle->states[i].usage_fd >= 0)
+			close(idle->states[i].usage_fd);
+	}
+	free(idle->states);
+	free(idle->cpus);
+	memset(idle, 0, sizeof(*idle));
+}
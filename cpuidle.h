@@ -0,0 +1,35 @@
+#ifndef _CPUIDLE_H_
+#define _CPUIDLE_H_
+
+#define CPUIDLE_NAME_LEN	16
+
+typedef struct cpuidle_state {
+	char		name[CPUIDLE_NAME_LEN];
+	unsigned int	latency;		//exit latency in us
+	int		time_fd, usage_fd;	//persistent, -1 when reopened per read
+	unsigned long long time, usage;		//cumulative counters
+	unsigned long long prev_time, prev_usage;
+	unsigned int	residency;		//time in state, 0.1% of the interval
+}Cpuidle_state_t;
+
+typedef struct cpuidle_cpu {
+	Cpuidle_state_t	*states;		//slice of Cpuidle_t.states
+	unsigned int	nr_states;
+	unsigned int	wake_latency;		//average exit latency per wakeup (us)
+	unsigned int	wake_exposure;		//exit latency paid, 0.1% of the interval
+	int		busy;			//time in no state, 0.1% units, -1 unknown
+}Cpuidle_cpu_t;
+
+typedef struct cpuidle {
+	unsigned int	nr_cpus;
+	unsigned int	nr_states;		//total states of all cpus
+	Cpuidle_cpu_t	*cpus;
+	Cpuidle_state_t	*states;
+	unsigned long long last_ns;		//CLOCK_MONOTONIC of the last sample
+}Cpuidle_t;
+
+int init_cpuidle(Cpuidle_t *idle, unsigned int nr_cpus);
+void cpuidle_sample(Cpuidle_t *idle);
+void destroy_cpuidle(Cpuidle_t *idle);
+
+#endif
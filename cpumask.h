@@ -1,7 +1,9 @@
 #ifndef __LINUX_CPUMASK_H
 #define __LINUX_CPUMASK_H
 
-#define NR_CPUS 4096
+#ifndef NR_CPUS
+#define NR_CPUS 4096	/* make NR_CPUS=N builds for another width */
+#endif
 /*
  * Cpumasks provide a bitmap suitable for representing the
  * set of CPU's in a system, one bit position per CPU number.
@@ -64,6 +66,15 @@
  *
  * for_each_online_cpu(cpu)		for-loop cpu over cpu_online_map
  *
+ * On an atomic_cpumask_t, for threads writing one mask at once:
+ *
+ * void atomic_cpu_set(cpu, mask)	atomically turn on bit 'cpu'
+ * void atomic_cpu_clear(cpu, mask)	atomically turn off bit 'cpu'
+ * int atomic_cpu_isset(cpu, mask)	true iff bit 'cpu' set in mask
+ * int atomic_cpu_test_and_set(cpu, mask) atomically test and set bit 'cpu'
+ * void atomic_cpus_clear(mask)		clear all bits
+ * void atomic_cpus_read(dst, src)	copy to the cpumask_t dst
+ *
  * Subtlety:
  * 1) The 'type-checked' form of cpu_isset() causes gcc (3.3.2, anyway)
  *    to generate slightly worse code.  Note for example the additional
@@ -72,10 +83,23 @@
  *    drivers/block/genhd.c (arch i386, CONFIG_SMP=y).  So use a simple
  *    one-line #define for cpu_isset(), instead of wrapping an inline
  *    inside a macro, the way we do the other calls.
+ * 2) When NR_CPUS fills whole words, the mask operations are loops of a
+ *    constant CPUMASK_LONGS words that the compiler inlines and unrolls
+ *    or vectorizes, instead of the runtime width __bitmap_*() calls into
+ *    bitmap.c, and the iterators scan words inline.  The tests (equal,
+ *    empty, ...) have no early exit: the answers the sampler usually
+ *    gets, equal and empty, read every word anyway.  Other widths, and
+ *    builds with CPUMASK_GENERIC, take the generic bitmap_*() path.
  */
 
 #include "bitmap.h"
 
+/* Fixed width fast paths - see Subtlety (2) above. */
+#if !defined(CPUMASK_GENERIC) && NR_CPUS % (__SIZEOF_LONG__ * 8) == 0
+#define CPUMASK_FIXED
+#define CPUMASK_LONGS	(NR_CPUS / (__SIZEOF_LONG__ * 8))
+#endif
+
 typedef struct { DECLARE_BITMAP(bits, NR_CPUS); } cpumask_t;
 extern cpumask_t _unused_cpumask_arg_;
 
@@ -112,21 +136,42 @@ static inline void __cpus_clear(cpumask_t *dstp, int nbits)
 static inline void __cpus_and(cpumask_t *dstp, const cpumask_t *src1p,
 					const cpumask_t *src2p, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		dstp->bits[i] = src1p->bits[i] & src2p->bits[i];
+#else
 	bitmap_and(dstp->bits, src1p->bits, src2p->bits, nbits);
+#endif
 }
 
 #define cpus_or(dst, src1, src2) __cpus_or(&(dst), &(src1), &(src2), NR_CPUS)
 static inline void __cpus_or(cpumask_t *dstp, const cpumask_t *src1p,
 					const cpumask_t *src2p, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		dstp->bits[i] = src1p->bits[i] | src2p->bits[i];
+#else
 	bitmap_or(dstp->bits, src1p->bits, src2p->bits, nbits);
+#endif
 }
 
 #define cpus_xor(dst, src1, src2) __cpus_xor(&(dst), &(src1), &(src2), NR_CPUS)
 static inline void __cpus_xor(cpumask_t *dstp, const cpumask_t *src1p,
 					const cpumask_t *src2p, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		dstp->bits[i] = src1p->bits[i] ^ src2p->bits[i];
+#else
 	bitmap_xor(dstp->bits, src1p->bits, src2p->bits, nbits);
+#endif
 }
 
 #define cpus_andnot(dst, src1, src2) \
@@ -134,53 +179,120 @@ static inline void __cpus_xor(cpumask_t *dstp, const cpumask_t *src1p,
 static inline void __cpus_andnot(cpumask_t *dstp, const cpumask_t *src1p,
 					const cpumask_t *src2p, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		dstp->bits[i] = src1p->bits[i] & ~src2p->bits[i];
+#else
 	bitmap_andnot(dstp->bits, src1p->bits, src2p->bits, nbits);
+#endif
 }
 
 #define cpus_complement(dst, src) __cpus_complement(&(dst), &(src), NR_CPUS)
 static inline void __cpus_complement(cpumask_t *dstp,
 					const cpumask_t *srcp, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		dstp->bits[i] = ~srcp->bits[i];
+#else
 	bitmap_complement(dstp->bits, srcp->bits, nbits);
+#endif
 }
 
 #define cpus_equal(src1, src2) __cpus_equal(&(src1), &(src2), NR_CPUS)
 static inline int __cpus_equal(const cpumask_t *src1p,
 					const cpumask_t *src2p, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	unsigned long diff = 0;
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		diff |= src1p->bits[i] ^ src2p->bits[i];
+	return !diff;
+#else
 	return bitmap_equal(src1p->bits, src2p->bits, nbits);
+#endif
 }
 
 #define cpus_intersects(src1, src2) __cpus_intersects(&(src1), &(src2), NR_CPUS)
 static inline int __cpus_intersects(const cpumask_t *src1p,
 					const cpumask_t *src2p, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	unsigned long both = 0;
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		both |= src1p->bits[i] & src2p->bits[i];
+	return both != 0;
+#else
 	return bitmap_intersects(src1p->bits, src2p->bits, nbits);
+#endif
 }
 
 #define cpus_subset(src1, src2) __cpus_subset(&(src1), &(src2), NR_CPUS)
 static inline int __cpus_subset(const cpumask_t *src1p,
 					const cpumask_t *src2p, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	unsigned long diff = 0;
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		diff |= src1p->bits[i] & ~src2p->bits[i];
+	return !diff;
+#else
 	return bitmap_subset(src1p->bits, src2p->bits, nbits);
+#endif
 }
 
 #define cpus_empty(src) __cpus_empty(&(src), NR_CPUS)
 static inline int __cpus_empty(const cpumask_t *srcp, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	unsigned long any = 0;
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		any |= srcp->bits[i];
+	return !any;
+#else
 	return bitmap_empty(srcp->bits, nbits);
+#endif
 }
 
 #define cpus_full(cpumask) __cpus_full(&(cpumask), NR_CPUS)
 static inline int __cpus_full(const cpumask_t *srcp, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	unsigned long all = ~0UL;
+	int i;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		all &= srcp->bits[i];
+	return !~all;
+#else
 	return bitmap_full(srcp->bits, nbits);
+#endif
 }
 
 #define cpus_weight(cpumask) __cpus_weight(&(cpumask), NR_CPUS)
 static inline int __cpus_weight(const cpumask_t *srcp, int nbits)
 {
+#ifdef CPUMASK_FIXED
+	int i, weight = 0;
+
+	for (i = 0; i < CPUMASK_LONGS; i++)
+		weight += hweight_long(srcp->bits[i]);
+	return weight;
+#else
 	return bitmap_weight(srcp->bits, nbits);
+#endif
 }
 
 #define cpus_shift_right(dst, src, n) \
@@ -199,16 +311,44 @@ static inline void __cpus_shift_left(cpumask_t *dstp,
 	bitmap_shift_left(dstp->bits, srcp->bits, n, nbits);
 }
 
+#ifdef CPUMASK_FIXED
+/* First set bit at or past @n, or NR_CPUS */
+static inline int __cpumask_find(int n, const cpumask_t *srcp)
+{
+	unsigned long word;
+	int i;
+
+	if (n >= NR_CPUS)
+		return NR_CPUS;
+	i = n / BITS_PER_LONG;
+	word = srcp->bits[i] & BITMAP_FIRST_WORD_MASK(n);
+	while (!word) {
+		if (++i == CPUMASK_LONGS)
+			return NR_CPUS;
+		word = srcp->bits[i];
+	}
+	return i * BITS_PER_LONG + __builtin_ctzl(word);
+}
+#endif
+
 #define first_cpu(src) __first_cpu(&(src))
 static inline int __first_cpu(const cpumask_t *srcp)
 {
-	return ffs(*srcp->bits)-1;
+#ifdef CPUMASK_FIXED
+	return __cpumask_find(0, srcp);
+#else
+	return find_first_bit(cpumask_bits(srcp), NR_CPUS);
+#endif
 }
 
 #define next_cpu(n, src) __next_cpu((n), &(src))
 static inline int __next_cpu(int n, const cpumask_t *srcp)
 {
+#ifdef CPUMASK_FIXED
+	return __cpumask_find(n + 1, srcp);
+#else
 	return find_next_bit(cpumask_bits(srcp), NR_CPUS, n + 1);
+#endif
 }
 
 #define cpumask_of_cpu(cpu)						\
@@ -289,6 +429,41 @@ static inline void __cpus_remap(cpumask_t *dstp, const cpumask_t *srcp,
 	bitmap_remap(dstp->bits, srcp->bits, oldp->bits, newp->bits, nbits);
 }
 
+/*
+ * cpu_set() and friends are plain read-modify-writes of a whole word, so
+ * two threads setting cpus that share a word can lose one of the
+ * updates.  Masks written by more than one thread at a time are
+ * atomic_cpumask_t and only take the atomic_cpu_*() ops; once the
+ * writers are done, atomic_cpus_read() gives a cpumask_t for the rest.
+ */
+typedef struct { _Atomic unsigned long bits[BITS_TO_LONGS(NR_CPUS)]; } atomic_cpumask_t;
+
+#define atomic_cpu_set(cpu, dst) atomic_set_bit((cpu), (dst).bits)
+#define atomic_cpu_clear(cpu, dst) atomic_clear_bit((cpu), (dst).bits)
+#define atomic_cpu_isset(cpu, mask) atomic_test_bit((cpu), (mask).bits)
+#define atomic_cpu_test_and_set(cpu, mask) \
+			atomic_test_and_set_bit((cpu), (mask).bits)
+
+#define atomic_cpus_clear(dst) __atomic_cpus_clear(&(dst))
+static inline void __atomic_cpus_clear(atomic_cpumask_t *dstp)
+{
+	int i;
+
+	for (i = 0; i < BITS_TO_LONGS(NR_CPUS); i++)
+		atomic_store_explicit(&dstp->bits[i], 0, memory_order_relaxed);
+}
+
+#define atomic_cpus_read(dst, src) __atomic_cpus_read(&(dst), &(src))
+static inline void __atomic_cpus_read(cpumask_t *dstp,
+					const atomic_cpumask_t *srcp)
+{
+	int i;
+
+	for (i = 0; i < BITS_TO_LONGS(NR_CPUS); i++)
+		dstp->bits[i] = atomic_load_explicit(&srcp->bits[i],
+					memory_order_relaxed);
+}
+
 #if NR_CPUS > 1
 #define for_each_cpu_mask(cpu, mask)		\
 	for ((cpu) = first_cpu(mask);		\
@@ -0,0 +1,609 @@
+#define _GNU_SOURCE	/* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "system_monitor.h"
+#include "outbuf.h"
+#include "daemon.h"
+
+#define DAEMON_MAX_EVENTS	64
+#define DAEMON_REQ_SIZE		1024
+#define HTTP_HEADER_SIZE	192
+#define DAEMON_MAX_CLIENTS	256	//connections past this are closed at accept
+#define DAEMON_CLIENT_IDLE_MS	5000	//no progress for this long drops a client
+
+enum {
+	HTTP_ROUTE_UNKNOWN,
+	HTTP_ROUTE_METRICS,
+	HTTP_ROUTE_NOT_FOUND,
+};
+
+/*
+ * Metrics payload and its HTTP header, rendered once per tick.  Two
+ * slabs flip on each tick; scrapers writev() straight out of the front
+ * one, so a scrape costs the same whatever the cpu and scraper count.
+ */
+typedef struct metrics_slab {
+	char		header[HTTP_HEADER_SIZE];
+	int		header_len;
+	Outbuf_t	body;
+	unsigned int	users;			//clients still sending from it
+}Metrics_slab_t;
+
+typedef struct client {
+	int		fd;
+	int		http;			//accepted on the HTTP listener
+	int		route;			//HTTP_ROUTE_*, from the request line
+	char		req[DAEMON_REQ_SIZE];	//request being read
+	size_t		req_len;
+	int		replying;		//request parsed, writing iov
+	Outbuf_t	resp;			//reply rendered for this client
+	Metrics_slab_t	*slab;			//shared payload being sent
+	struct iovec	iov[2];			//what is left to send
+	int		iovcnt;
+	unsigned long long last_ns;		//last read or write that moved
+	struct client	*prev, *next;		//Daemon_state_t.clients
+}Client_t;
+
+typedef struct daemon_state {
+	int		epfd, listen_fd, http_fd, timer_fd;
+	const Daemon_ops_t *ops;
+	Outbuf_t	*ring;			//rendered ticks, history long
+	unsigned int	history;
+	unsigned int	head;			//next slot to render into
+	unsigned int	nr;			//valid slots
+	Metrics_slab_t	slab[2];
+	int		front;			//slab new scrapers are served
+	Client_t	*clients;		//connected, for the idle sweep
+	unsigned int	nr_clients;
+}Daemon_state_t;
+
+/* epoll tags of the non client descriptors */
+static char listen_tag, http_tag, timer_tag;
+
+/*
+ * A socket left by a run that died would make bind() fail, remove it.
+ * Anything that is not a socket, or a socket a live daemon still
+ * accepts on, is left alone.
+ */
+static int daemon_remove_stale(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, ret;
+
+	if (lstat(addr->sun_path, &st) < 0)
+		return errno == ENOENT ? 0 : -errno;
+	if (!S_ISSOCK(st.st_mode)) {
+		printf("%s exists and is not a socket\n", addr->sun_path);
+		return -EEXIST;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+	close(fd);
+	if (ret == 0) {
+		printf("%s is in use by a running daemon\n", addr->sun_path);
+		return -EADDRINUSE;
+	}
+	if (unlink(addr->sun_path) < 0)
+		return -errno;
+	return 0;
+}
+
+static int daemon_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd, ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("socket path too long:%s\n", path);
+		return -ENAMETOOLONG;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	ret = daemon_remove_stale(&addr);
+	if (ret < 0)
+		return ret;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		int ret = -errno;
+
+		printf("listen on %s failed:%s\n", path, strerror(errno));
+		close(fd);
+		return ret;
+	}
+	return fd;
+}
+
+/* [ADDR:]PORT, IPv4 only, loopback unless an address is given */
+static int daemon_listen_tcp(const char *listen_addr)
+{
+	struct sockaddr_in addr;
+	const char *port = strrchr(listen_addr, ':');
+	char host[INET_ADDRSTRLEN];
+	char *end;
+	long nr;
+	int fd, on = 1;
+
+	if (port) {
+		if (port - listen_addr >= sizeof(host))
+			goto invalid;
+		memcpy(host, listen_addr, port - listen_addr);
+		host[port - listen_addr] = '\0';
+		port++;
+	} else {
+		strcpy(host, DAEMON_LISTEN_ADDR);
+		port = listen_addr;
+	}
+	nr = strtol(port, &end, 10);
+	if (*end || nr <= 0 || nr > 65535)
+		goto invalid;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(nr);
+	if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+		goto invalid;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		int ret = -errno;
+
+		printf("listen on %s failed:%s\n", listen_addr, strerror(errno));
+		close(fd);
+		return ret;
+	}
+	return fd;
+
+invalid:
+	printf("Invalid listen address:%s\n", listen_addr);
+	return -EINVAL;
+}
+
+static int daemon_timer(int interval)
+{
+	struct itimerspec its;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	its.it_interval.tv_sec = interval / MSEC_PER_SEC;
+	its.it_interval.tv_nsec = (interval % MSEC_PER_SEC) * NSEC_PER_MSEC;
+	if (!its.it_interval.tv_sec && !its.it_interval.tv_nsec)
+		its.it_interval.tv_nsec = NSEC_PER_MSEC;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+static void daemon_close_client(Daemon_state_t *d, Client_t *c)
+{
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		d->clients = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	d->nr_clients--;
+	epoll_ctl(d->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	if (c->slab)
+		c->slab->users--;
+	destroy_outbuf(&c->resp);
+	free(c);
+}
+
+static const Outbuf_t *daemon_slot(const Daemon_state_t *d, unsigned int age)
+{
+	return &d->ring[(d->head + d->history - 1 - age) % d->history];
+}
+
+static void daemon_handle_request(Daemon_state_t *d, Client_t *c)
+{
+	char *req = c->req;
+	unsigned long n;
+	int i;
+
+	req[strcspn(req, "\r\n")] = '\0';
+	if (!strcmp(req, "snapshot")) {
+		if (d->nr)
+			outbuf_copy(&c->resp, daemon_slot(d, 0));
+	} else if (!strncmp(req, "last", 4)) {
+		n = strtoul(req + 4, NULL, 10);
+		if (!n || n > d->nr)
+			n = d->nr;
+		for (i = n - 1; i >= 0; i--) {
+			const Outbuf_t *slot = daemon_slot(d, i);
+
+			outbuf_write(&c->resp, slot->buf, slot->len);
+		}
+	} else if (!strcmp(req, "summary")) {
+		d->ops->summary(&c->resp);
+	} else {
+		outbuf_printf(&c->resp, "error: unknown request '%s'\n", req);
+	}
+	c->iov[0].iov_base = c->resp.buf;
+	c->iov[0].iov_len = c->resp.len;
+	c->iovcnt = 1;
+	c->replying = 1;
+}
+
+static int http_route(const char *req)
+{
+	if (!strncmp(req, "GET /metrics ", 13) || !strncmp(req, "GET / ", 6))
+		return HTTP_ROUTE_METRICS;
+	return HTTP_ROUTE_NOT_FOUND;
+}
+
+static void daemon_handle_http(Daemon_state_t *d, Client_t *c)
+{
+	Metrics_slab_t *slab = &d->slab[d->front];
+
+	if (c->route == HTTP_ROUTE_METRICS) {
+		slab->users++;
+		c->slab = slab;
+		c->iov[0].iov_base = slab->header;
+		c->iov[0].iov_len = slab->header_len;
+		c->iov[1].iov_base = slab->body.buf;
+		c->iov[1].iov_len = slab->body.len;
+		c->iovcnt = 2;
+	} else {
+		outbuf_printf(&c->resp, "HTTP/1.1 404 Not Found\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 10\r\n"
+			"Connection: close\r\n\r\nnot found\n");
+		c->iov[0].iov_base = c->resp.buf;
+		c->iov[0].iov_len = c->resp.len;
+		c->iovcnt = 1;
+	}
+	c->replying = 1;
+}
+
+/*
+ * Only the request line matters, the headers are read to their end and
+ * dropped; when they overflow req[] just the tail is kept to find it.
+ */
+static int http_request_done(Client_t *c)
+{
+	if (c->route == HTTP_ROUTE_UNKNOWN && strchr(c->req, '\n'))
+		c->route = http_route(c->req);
+	if (strstr(c->req, "\r\n\r\n") || strstr(c->req, "\n\n"))
+		return 1;
+	if (c->req_len == DAEMON_REQ_SIZE - 1) {
+		if (c->route == HTTP_ROUTE_UNKNOWN)
+			c->route = HTTP_ROUTE_NOT_FOUND;
+		memmove(c->req, c->req + c->req_len - 3, 4);
+		c->req_len = 3;
+	}
+	return 0;
+}
+
+/* Push as much of the reply as the socket takes; 1 when finished */
+static int daemon_client_write(Client_t *c)
+{
+	struct msghdr msg;
+
+	while (c->iovcnt) {
+		ssize_t nwrite;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = c->iov;
+		msg.msg_iovlen = c->iovcnt;
+		nwrite = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+		if (nwrite < 0)
+			return errno == EAGAIN ? 0 : -errno;
+
+		/* drop what went out, the socket may stop mid vector */
+		while (c->iovcnt && nwrite >= c->iov[0].iov_len) {
+			nwrite -= c->iov[0].iov_len;
+			c->iov[0] = c->iov[1];
+			c->iovcnt--;
+		}
+		if (c->iovcnt) {
+			c->iov[0].iov_base = (char *)c->iov[0].iov_base + nwrite;
+			c->iov[0].iov_len -= nwrite;
+		}
+	}
+	return 1;
+}
+
+static void daemon_client_event(Daemon_state_t *d, Client_t *c)
+{
+	struct epoll_event ev;
+	int ret;
+
+	c->last_ns = monotonic_ns();
+	if (!c->replying) {
+		ssize_t nread;
+
+		nread = recv(c->fd, c->req + c->req_len,
+				DAEMON_REQ_SIZE - 1 - c->req_len, 0);
+		if (nread < 0 && errno == EAGAIN)
+			return;
+		if (nread < 0 || (nread == 0 && !c->req_len)) {
+			daemon_close_client(d, c);
+			return;
+		}
+		c->req_len += nread;
+		c->req[c->req_len] = '\0';
+		if (c->http) {
+			if (!http_request_done(c) && nread)
+				return;
+			daemon_handle_http(d, c);
+		} else {
+			/* wait for the full line unless the peer is done sending */
+			if (nread && !strchr(c->req, '\n') &&
+			    c->req_len < DAEMON_REQ_SIZE - 1)
+				return;
+			daemon_handle_request(d, c);
+		}
+	}
+
+	ret = daemon_client_write(c);
+	if (ret) {
+		daemon_close_client(d, c);
+		return;
+	}
+	/* the socket is full, finish once it drains */
+	ev.events = EPOLLOUT;
+	ev.data.ptr = c;
+	epoll_ctl(d->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void daemon_accept(Daemon_state_t *d, int listen_fd, int http)
+{
+	struct epoll_event ev;
+
+	for (;;) {
+		Client_t *c;
+		int fd;
+
+		fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+		if (d->nr_clients >= DAEMON_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		c = (Client_t *)calloc(1, sizeof(Client_t));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->http = http;
+		c->last_ns = monotonic_ns();
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close(fd);
+			free(c);
+			continue;
+		}
+		c->next = d->clients;
+		if (d->clients)
+			d->clients->prev = c;
+		d->clients = c;
+		d->nr_clients++;
+	}
+}
+
+/*
+ * Drop clients that neither sent nor took anything for
+ * DAEMON_CLIENT_IDLE_MS, so a peer that connects and goes quiet does
+ * not hold its slot.  Runs after an epoll batch, never inside one,
+ * since a later event of the batch may point at the client.
+ */
+static void daemon_sweep_clients(Daemon_state_t *d)
+{
+	unsigned long long now = monotonic_ns();
+	Client_t *c, *next;
+
+	for (c = d->clients; c; c = next) {
+		next = c->next;
+		if (now - c->last_ns >= DAEMON_CLIENT_IDLE_MS * NSEC_PER_MSEC)
+			daemon_close_client(d, c);
+	}
+}
+
+static void daemon_render_metrics(Daemon_state_t *d)
+{
+	Metrics_slab_t *back = &d->slab[!d->front];
+
+	/* a slow scraper still sends from it, serve the front one more tick */
+	if (back->users)
+		return;
+	outbuf_reset(&back->body);
+	d->ops->metrics(&back->body);
+	back->header_len = snprintf(back->header, sizeof(back->header),
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: close\r\n\r\n", back->body.len);
+	d->front = !d->front;
+}
+
+static void daemon_tick(Daemon_state_t *d)
+{
+	Outbuf_t *slot = &d->ring[d->head];
+
+	outbuf_reset(slot);
+	d->ops->tick(slot);
+	d->head = (d->head + 1) % d->history;
+	if (d->nr < d->history)
+		d->nr++;
+	if (d->http_fd >= 0)
+		daemon_render_metrics(d);
+}
+
+int daemon_run(const Daemon_conf_t *conf, const Daemon_ops_t *ops,
+		volatile sig_atomic_t *stop)
+{
+	struct epoll_event ev, events[DAEMON_MAX_EVENTS];
+	Daemon_state_t d;
+	int ret = 0;
+	int i;
+
+	memset(&d, 0, sizeof(d));
+	d.ops = ops;
+	d.history = conf->history ? conf->history : 1;
+	d.listen_fd = d.http_fd = d.timer_fd = -1;
+	d.ring = (Outbuf_t *)calloc(d.history, sizeof(Outbuf_t));
+	if (!d.ring) {
+		printf("alloc mem for daemon history failed\n");
+		return -ENOMEM;
+	}
+
+	d.epfd = epoll_create1(EPOLL_CLOEXEC);
+	d.timer_fd = daemon_timer(conf->interval);
+	if (d.epfd < 0 || d.timer_fd < 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (conf->socket_path) {
+		d.listen_fd = daemon_listen(conf->socket_path);
+		if (d.listen_fd < 0) {
+			ret = d.listen_fd;
+			goto out;
+		}
+		ev.events = EPOLLIN;
+		ev.data.ptr = &listen_tag;
+		epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.listen_fd, &ev);
+	}
+	if (conf->listen) {
+		d.http_fd = daemon_listen_tcp(conf->listen);
+		if (d.http_fd < 0) {
+			ret = d.http_fd;
+			goto out;
+		}
+		ev.events = EPOLLIN;
+		ev.data.ptr = &http_tag;
+		epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.http_fd, &ev);
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &timer_tag;
+	epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.timer_fd, &ev);
+
+	/* the first tick pays the warm-up, serve nothing before it */
+	daemon_tick(&d);
+
+	while (!*stop) {
+		int nr = epoll_wait(d.epfd, events, DAEMON_MAX_EVENTS, -1);
+		int ticked = 0;
+
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+		for (i = 0; i < nr; i++) {
+			void *ptr = events[i].data.ptr;
+
+			if (ptr == &timer_tag) {
+				uint64_t expirations;
+
+				if (read(d.timer_fd, &expirations,
+					sizeof(expirations)) > 0) {
+					daemon_tick(&d);
+					ticked = 1;
+				}
+			} else if (ptr == &listen_tag) {
+				daemon_accept(&d, d.listen_fd, 0);
+			} else if (ptr == &http_tag) {
+				daemon_accept(&d, d.http_fd, 1);
+			} else {
+				daemon_client_event(&d, (Client_t *)ptr);
+			}
+		}
+		if (ticked)
+			daemon_sweep_clients(&d);
+	}
+
+out:
+	while (d.clients)
+		daemon_close_client(&d, d.clients);
+	if (d.listen_fd >= 0) {
+		close(d.listen_fd);
+		unlink(conf->socket_path);
+	}
+	if (d.http_fd >= 0)
+		close(d.http_fd);
+	if (d.timer_fd >= 0)
+		close(d.timer_fd);
+	if (d.epfd >= 0)
+		close(d.epfd);
+	for (i = 0; i < d.history; i++)
+		destroy_outbuf(&d.ring[i]);
+	destroy_outbuf(&d.slab[0].body);
+	destroy_outbuf(&d.slab[1].body);
+	free(d.ring);
+	return ret;
+}
+
+int daemon_client(const char *path, const char *request)
+{
+	struct sockaddr_un addr;
+	char buf[4096];
+	ssize_t nread;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		printf("connect to %s failed:%s\n", path, strerror(errno));
+		close(fd);
+		return -ECONNREFUSED;
+	}
+
+	snprintf(buf, sizeof(buf), "%s\n", request);
+	if (send(fd, buf, strlen(buf), MSG_NOSIGNAL) < 0) {
+		close(fd);
+		return -errno;
+	}
+	shutdown(fd, SHUT_WR);
+
+	while ((nread = recv(fd, buf, sizeof(buf), 0)) > 0)
+		fwrite(buf, 1, nread, stdout);
+	fflush(stdout);
+	close(fd);
+	return nread < 0 ? -errno : 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <signal.h>
+
+#include "outbuf.h"
+
+#define DAEMON_SOCKET_PATH	"/run/system_monitor.sock"
+#define DAEMON_HISTORY		60	//ticks kept for "last N" requests
+#define DAEMON_LISTEN_ADDR	"127.0.0.1"	//--listen without an address
+
+/* Hooks the daemon loop calls into the monitor */
+typedef struct daemon_ops {
+	void	(*tick)(Outbuf_t *out);		//sample and render one tick
+	void	(*summary)(Outbuf_t *out);	//render summary statistics
+	void	(*metrics)(Outbuf_t *out);	//render the exposition payload
+}Daemon_ops_t;
+
+typedef struct daemon_conf {
+	const char	*socket_path;	//unix query socket, NULL for none
+	const char	*listen;	//[ADDR:]PORT of the HTTP endpoint, NULL for none
+	int		interval;	//ms between ticks
+	unsigned int	history;	//ticks kept for "last N"
+}Daemon_conf_t;
+
+/*
+ * Unix socket requests are one line each, the reply is sent and the
+ * connection closed:
+ *   snapshot	latest tick
+ *   last N	the N latest ticks, oldest first
+ *   summary	per cpu summary statistics
+ *
+ * The HTTP endpoint answers GET /metrics with the payload rendered at
+ * the last tick.  Either side drops connections that stall for a few
+ * seconds and, past a fixed number, new ones.  The socket path is only
+ * replaced when it is a socket no daemon answers on.
+ */
+int daemon_run(const Daemon_conf_t *conf, const Daemon_ops_t *ops,
+		volatile sig_atomic_t *stop);
+int daemon_client(const char *path, const char *request);
+
+#endif
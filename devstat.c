@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <regex.h>
+#include <errno.h>
+
+#include "system_monitor.h"
+#include "devstat.h"
+
+#define DEV_BUF_SIZE	8192
+
+/*
+ * diskstats: major minor name rd_ios rd_merges rd_sectors rd_ticks
+ *            wr_ios wr_merges wr_sectors wr_ticks in_flight io_ticks ...
+ */
+static const int disk_columns[NR_DISK_FIELDS] = {
+	[DISK_RD_IOS]		= 0,
+	[DISK_RD_SECTORS]	= 2,
+	[DISK_WR_IOS]		= 4,
+	[DISK_WR_SECTORS]	= 6,
+	[DISK_IO_TICKS]		= 9,
+};
+
+/*
+ * net/dev: name: rx_bytes packets errs drop fifo frame compressed multicast
+ *                tx_bytes packets errs drop ...
+ */
+static const int net_columns[NR_NET_FIELDS] = {
+	[NET_RX_BYTES]		= 0,
+	[NET_RX_PACKETS]	= 1,
+	[NET_RX_DROP]		= 3,
+	[NET_TX_BYTES]		= 8,
+	[NET_TX_PACKETS]	= 9,
+	[NET_TX_DROP]		= 11,
+};
+
+int dev_filter_set(Dev_filter_t *filter, const char *regex, int exclude)
+{
+	regex_t *re = exclude ? &filter->exclude : &filter->include;
+	int *has = exclude ? &filter->has_exclude : &filter->has_include;
+
+	if (*has)
+		regfree(re);
+	*has = 0;
+	if (regcomp(re, regex, REG_EXTENDED | REG_NOSUB))
+		return -EINVAL;
+	*has = 1;
+	return 0;
+}
+
+static int dev_filter_match(const Dev_filter_t *filter, const char *name)
+{
+	if (!filter)
+		return 1;
+	if (filter->has_include && regexec(&filter->include, name, 0, NULL, 0))
+		return 0;
+	if (filter->has_exclude && !regexec(&filter->exclude, name, 0, NULL, 0))
+		return 0;
+	return 1;
+}
+
+int init_dev_table(Dev_table_t *table, int is_net)
+{
+	char path[PATH_MAX];
+
+	memset(table, 0, sizeof(*table));
+	if (is_net) {
+		table->path = NETDEV_PATH;
+		table->skip_lines = 2;
+		table->name_col = 0;
+		table->columns = net_columns;
+		table->nr_fields = NR_NET_FIELDS;
+	} else {
+		table->path = DISKSTATS_PATH;
+		table->skip_lines = 0;
+		table->name_col = 2;
+		table->columns = disk_columns;
+		table->nr_fields = NR_DISK_FIELDS;
+	}
+
+	root_path(path, PATH_MAX, "%s", table->path);
+	table->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (table->fd < 0) {
+		printf("Need to support %s\n", table->path);
+		return -EINVAL;
+	}
+	table->size = DEV_BUF_SIZE;
+	table->buf = (char *)malloc(table->size);
+	if (!table->buf) {
+		printf("alloc mem for %s failed\n", table->path);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static unsigned int dev_table_count_lines(const char *buf)
+{
+	unsigned int nr = 0;
+
+	while ((buf = strchr(buf, '\n'))) {
+		buf++;
+		nr++;
+	}
+	return nr;
+}
+
+/*
+ * Rebuild the device set from table->buf.  Counters of devices that are
+ * still there move to their new index so their rates stay continuous.
+ */
+static int dev_table_scan(Dev_table_t *table, const Dev_filter_t *filter,
+				unsigned int nr_lines)
+{
+	size_t cnt_size = nr_lines * table->nr_fields * sizeof(unsigned long long);
+	char (*names)[DEV_NAME_LEN];
+	unsigned long long *cur, *prev, *rate;
+	int *dev_of_line, *offset;
+	unsigned int nr_devs = 0;
+	char *line = table->buf;
+	int nr, i;
+
+	dev_of_line = (int *)malloc(nr_lines * sizeof(int));
+	offset = (int *)malloc(nr_lines * sizeof(int));
+	names = malloc(nr_lines * DEV_NAME_LEN);
+	cur = (unsigned long long *)calloc(1, cnt_size);
+	prev = (unsigned long long *)calloc(1, cnt_size);
+	rate = (unsigned long long *)calloc(1, cnt_size);
+	if ((nr_lines && (!dev_of_line || !offset || !names)) ||
+	    (cnt_size && (!cur || !prev || !rate))) {
+		free(dev_of_line);
+		free(offset);
+		free(names);
+		free(cur);
+		free(prev);
+		free(rate);
+		printf("alloc mem for %s failed\n", table->path);
+		return -ENOMEM;
+	}
+
+	for (nr = 0; nr < nr_lines && *line; nr++) {
+		char *p = line;
+		size_t len;
+		int col;
+
+		dev_of_line[nr] = -1;
+		if (nr < table->skip_lines)
+			goto next;
+
+		for (col = 0; col < table->name_col; col++) {
+			p += strspn(p, " \t");
+			p += strcspn(p, " \t\n");
+		}
+		p += strspn(p, " \t");
+		len = strcspn(p, " \t:\n");
+		if (!len || len >= DEV_NAME_LEN)
+			goto next;
+		memcpy(names[nr_devs], p, len);
+		names[nr_devs][len] = '\0';
+		if (!dev_filter_match(filter, names[nr_devs]))
+			goto next;
+
+		p += len;
+		if (*p == ':')
+			p++;
+		offset[nr] = p - line;
+		dev_of_line[nr] = nr_devs;
+
+		for (i = 0; i < table->nr_devs; i++) {
+			if (strcmp(table->names[i], names[nr_devs]))
+				continue;
+			memcpy(&cur[nr_devs * table->nr_fields],
+				&table->cur[i * table->nr_fields],
+				table->nr_fields * sizeof(unsigned long long));
+			break;
+		}
+		nr_devs++;
+next:
+		line = strchr(line, '\n');
+		if (!line)
+			break;
+		line++;
+	}
+
+	free(table->dev_of_line);
+	free(table->offset);
+	free(table->names);
+	free(table->cur);
+	free(table->prev);
+	free(table->rate);
+	table->dev_of_line = dev_of_line;
+	table->offset = offset;
+	table->names = names;
+	table->cur = cur;
+	table->prev = prev;
+	table->rate = rate;
+	table->nr_devs = nr_devs;
+	table->nr_lines = nr_lines;
+#ifdef DEBUG
+	printf("%s: %u lines, %u devices\n", table->path, nr_lines, nr_devs);
+#endif
+	return 0;
+}
+
+static void dev_table_parse_line(Dev_table_t *table, char *p,
+				unsigned long long *counts)
+{
+	int col = 0, f = 0;
+
+	/* columns[] is ascending, convert up to the last wanted one */
+	while (f < table->nr_fields) {
+		char *end;
+		unsigned long long val = strtoull(p, &end, 10);
+
+		if (end == p)
+			break;
+		if (col == table->columns[f])
+			counts[f++] = val;
+		p = end;
+		col++;
+	}
+}
+
+int dev_table_sample(Dev_table_t *table, const Dev_filter_t *filter)
+{
+	size_t cnt_size;
+	unsigned long long now;
+	unsigned int nr_lines;
+	char *line;
+	int nr, i, ret;
+
+	ret = pread_whole_file(table->fd, &table->buf, &table->size);
+	if (ret < 0)
+		return ret;
+
+	nr_lines = dev_table_count_lines(table->buf);
+	if (nr_lines != table->nr_lines) {
+		ret = dev_table_scan(table, filter, nr_lines);
+		if (ret < 0)
+			return ret;
+	}
+
+	now = monotonic_ns();
+	table->elapsed_ns = table->last_ns ? now - table->last_ns : 0;
+	table->last_ns = now;
+
+	cnt_size = table->nr_devs * table->nr_fields * sizeof(unsigned long long);
+	memcpy(table->prev, table->cur, cnt_size);
+	memset(table->cur, 0, cnt_size);
+
+	line = table->buf;
+	for (nr = 0; nr < table->nr_lines; nr++) {
+		int dev = table->dev_of_line[nr];
+
+		if (dev >= 0)
+			dev_table_parse_line(table, line + table->offset[nr],
+					&table->cur[dev * table->nr_fields]);
+		line = strchr(line, '\n');
+		if (!line)
+			break;
+		line++;
+	}
+
+	for (i = 0; i < table->nr_devs * table->nr_fields; i++) {
+		/* Counters go back when a device is removed and re-added */
+		if (!table->elapsed_ns || table->cur[i] < table->prev[i])
+			table->rate[i] = 0;
+		else
+			table->rate[i] = (table->cur[i] - table->prev[i]) *
+					NSEC_PER_SEC / table->elapsed_ns;
+	}
+	return 0;
+}
+
+void destroy_dev_table(Dev_table_t *table)
+{
+	if (table->fd > 0)
+		close(table->fd);
+	free(table->buf);
+	free(table->dev_of_line);
+	free(table->offset);
+	free(table->names);
+	free(table->cur);
+	free(table->prev);
+	free(table->rate);
+	memset(table, 0, sizeof(*table));
+}
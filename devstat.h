@@ -0,0 +1,63 @@
+#ifndef _DEVSTAT_H_
+#define _DEVSTAT_H_
+
+#include <regex.h>
+
+#define DEV_NAME_LEN	32
+
+/* Counters kept per block device, columns of /proc/diskstats */
+enum disk_field {
+	DISK_RD_IOS = 0,
+	DISK_RD_SECTORS,
+	DISK_WR_IOS,
+	DISK_WR_SECTORS,
+	DISK_IO_TICKS,		//ms spent doing I/O
+	NR_DISK_FIELDS
+};
+
+/* Counters kept per network interface, columns of /proc/net/dev */
+enum net_field {
+	NET_RX_BYTES = 0,
+	NET_RX_PACKETS,
+	NET_RX_DROP,
+	NET_TX_BYTES,
+	NET_TX_PACKETS,
+	NET_TX_DROP,
+	NR_NET_FIELDS
+};
+
+typedef struct dev_filter {
+	regex_t		include, exclude;
+	int		has_include, has_exclude;
+}Dev_filter_t;
+
+/*
+ * One device per line table file.  The device set and the column each
+ * device's counters start at are cached, the file is only rescanned when
+ * its line count changes.
+ */
+typedef struct dev_table {
+	const char	*path;
+	int		fd;
+	char		*buf;			//read buffer reused across ticks
+	size_t		size;
+	unsigned int	skip_lines;		//header lines
+	unsigned int	name_col;		//whitespace column holding the name
+	const int	*columns;		//counter columns after the name
+	unsigned int	nr_fields;
+	unsigned int	nr_lines;		//line count the layout was built on
+	int		*dev_of_line;		//line -> device index, -1 if filtered
+	int		*offset;		//line -> offset of the first counter
+	unsigned int	nr_devs;
+	char		(*names)[DEV_NAME_LEN];
+	unsigned long long *cur, *prev;		//nr_devs * nr_fields
+	unsigned long long *rate;		//per second, nr_devs * nr_fields
+	unsigned long long last_ns, elapsed_ns;
+}Dev_table_t;
+
+int dev_filter_set(Dev_filter_t *filter, const char *regex, int exclude);
+int init_dev_table(Dev_table_t *table, int is_net);
+int dev_table_sample(Dev_table_t *table, const Dev_filter_t *filter);
+void destroy_dev_table(Dev_table_t *table);
+
+#endif
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE	/* CPU_ALLOC */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <malloc.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "cpumask.h"
+#include "system_monitor.h"
+#include "isolation.h"
+
+#define ISOLATED_PATH	CPU_PATH "/isolated"
+#define NOHZ_FULL_PATH	CPU_PATH "/nohz_full"
+#define ONLINE_PATH	CPU_PATH "/online"
+#define IRQ_BUF_SIZE	65536
+#define PREFAULT_STACK_SIZE	(256 * 1024)	//stack the ticks may touch
+
+/* Descriptions of the IPI lines, x86 and arm64 name them alike */
+static const char * const irq_names[NR_IRQ_KINDS] = {
+	[IRQ_CALL]	= "Function call interrupts",
+	[IRQ_RESCHED]	= "Rescheduling interrupts",
+	[IRQ_TLB]	= "TLB shootdowns",
+};
+
+static const char * const irq_short[NR_IRQ_KINDS] = {
+	[IRQ_CALL]	= "call",
+	[IRQ_RESCHED]	= "resched",
+	[IRQ_TLB]	= "tlb",
+};
+
+static void get_cpulist(char *line, void *data)
+{
+	cpumask_t *mask = (cpumask_t *)data;
+
+	/* an empty list reads "\n", older nohz_full reads "(null)" */
+	if (cpulist_parse(line, strcspn(line, "\n"), *mask) < 0)
+		cpus_clear(*mask);
+}
+
+static void read_cpulist(const char *path, cpumask_t *mask)
+{
+	char full[PATH_MAX];
+
+	cpus_clear(*mask);
+	root_path(full, PATH_MAX, "%s", path);
+	process_one_line(full, get_cpulist, mask);
+}
+
+int init_isolation(Isolation_t *iso)
+{
+	cpumask_t online;
+
+	memset(iso, 0, sizeof(*iso));
+	read_cpulist(ISOLATED_PATH, &iso->isolated);
+	read_cpulist(NOHZ_FULL_PATH, &iso->nohz_full);
+	read_cpulist(ONLINE_PATH, &online);
+	cpus_or(iso->quiet, iso->isolated, iso->nohz_full);
+	cpus_andnot(iso->housekeeping, online, iso->quiet);
+	return cpus_empty(iso->quiet) ? 0 : cpus_weight(iso->quiet);
+}
+
+/* Keep the calling thread, and the threads it starts later, on @cpus */
+int isolation_pin(const cpumask_t *cpus)
+{
+	size_t size = CPU_ALLOC_SIZE(NR_CPUS);
+	cpu_set_t *set;
+	int cpu, ret = 0;
+
+	if (cpus_empty(*cpus))
+		return 0;
+	set = CPU_ALLOC(NR_CPUS);
+	if (!set) {
+		printf("alloc mem for cpu affinity failed\n");
+		return -ENOMEM;
+	}
+	CPU_ZERO_S(size, set);
+	for_each_cpu_mask(cpu, *cpus)
+		CPU_SET_S(cpu, size, set);
+	if (sched_setaffinity(0, size, set) < 0) {
+		ret = -errno;
+		printf("pin to housekeeping cpus failed:%s\n", strerror(errno));
+	}
+	CPU_FREE(set);
+	return ret;
+}
+
+/*
+ * "idle" or "fifo[:PRIO]" for the calling thread and the ones it starts
+ * later.  SCHED_IDLE yields to any workload, SCHED_FIFO ticks on time.
+ */
+int isolation_set_sched(const char *policy)
+{
+	struct sched_param param;
+	int prio = 1;
+	int ret;
+
+	memset(&param, 0, sizeof(param));
+	if (!strcmp(policy, "idle")) {
+		ret = sched_setscheduler(0, SCHED_IDLE, &param);
+	} else if (!strncmp(policy, "fifo", strlen("fifo")) &&
+		   (!policy[4] || policy[4] == ':')) {
+		if (policy[4])
+			prio = atoi(policy + 5);
+		if (prio < sched_get_priority_min(SCHED_FIFO) ||
+		    prio > sched_get_priority_max(SCHED_FIFO)) {
+			printf("Invalid SCHED_FIFO priority:%d\n", prio);
+			return -EINVAL;
+		}
+		param.sched_priority = prio;
+		ret = sched_setscheduler(0, SCHED_FIFO, &param);
+	} else {
+		printf("Unknown scheduling policy:%s\n", policy);
+		return -EINVAL;
+	}
+	if (ret < 0) {
+		printf("set scheduling policy %s failed:%s\n", policy,
+			strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+/*
+ * Lock everything mapped now and later, with a prefaulted stack, and keep
+ * glibc from handing freed heap back to the kernel, which would fault the
+ * pages in again on the next tick.
+ */
+int isolation_lock_memory(void)
+{
+	char stack[PREFAULT_STACK_SIZE];
+
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		printf("mlockall failed:%s\n", strerror(errno));
+		return -errno;
+	}
+	memset(stack, 0, sizeof(stack));
+	/* keep the compiler from dropping the memset of a dead array */
+	__asm__ __volatile__("" : : "r"(stack) : "memory");
+	return 0;
+}
+
+int isolation_timer_slack(unsigned long ns)
+{
+	if (prctl(PR_SET_TIMERSLACK, ns ? ns : 1, 0, 0, 0) < 0) {
+		printf("set timer slack failed:%s\n", strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+/* Interval since the previous tick start, Welford mean and variance */
+void jitter_record(Jitter_t *jitter, unsigned long long now)
+{
+	double interval, delta;
+
+	if (jitter->last_ns) {
+		interval = (double)(now - jitter->last_ns);
+		jitter->count++;
+		delta = interval - jitter->mean;
+		jitter->mean += delta / jitter->count;
+		jitter->m2 += delta * (interval - jitter->mean);
+		if (jitter->count == 1 || interval < jitter->min)
+			jitter->min = interval;
+		if (interval > jitter->max)
+			jitter->max = interval;
+	}
+	jitter->last_ns = now;
+}
+
+void jitter_report(const Jitter_t *jitter, const char *mode)
+{
+	double stddev = jitter->count > 1 ?
+		sqrt(jitter->m2 / (jitter->count - 1)) : 0.0;
+
+	printf("jitter\tmode\tticks\tmean_us\tstddev_us\tmin_us\tmax_us\n");
+	printf("jitter\t%s\t%u\t%.1f\t%.1f\t%.1f\t%.1f\n", mode,
+		jitter->count, jitter->mean / NSEC_PER_USEC,
+		stddev / NSEC_PER_USEC, jitter->min / NSEC_PER_USEC,
+		jitter->max / NSEC_PER_USEC);
+}
+
+/*
+ * Sum the IPI lines of /proc/interrupts into @counts.  The header names
+ * the column of every online cpu, offline ones have none.
+ */
+static int irq_audit_read(Irq_audit_t *audit, unsigned long long *counts)
+{
+	static int column_cpu[NR_CPUS];
+	char path[PATH_MAX];
+	char *line, *eol, *p, *end;
+	int nr_columns = 0;
+	int fd, i, kind;
+	ssize_t len;
+
+	root_path(path, PATH_MAX, INTERRUPTS_PATH);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	len = pread_whole_file(fd, &audit->buf, &audit->size);
+	close(fd);
+	if (len < 0)
+		return len;
+
+	memset(counts, 0, audit->nr_cpus * NR_IRQ_KINDS * sizeof(*counts));
+	for (line = audit->buf; line && *line; line = eol ? eol + 1 : NULL) {
+		eol = strchr(line, '\n');
+		if (eol)
+			*eol = '\0';
+		if (line == audit->buf) {
+			/* header, "CPU0 CPU1 ..." */
+			for (p = line; (p = strstr(p, "CPU")) && nr_columns < NR_CPUS;
+			     p = end)
+				column_cpu[nr_columns++] = strtol(p + 3, &end, 10);
+			continue;
+		}
+		p = strchr(line, ':');
+		if (!p)
+			continue;
+		for (kind = 0; kind < NR_IRQ_KINDS; kind++)
+			if (strstr(p, irq_names[kind]))
+				break;
+		if (kind == NR_IRQ_KINDS)
+			continue;
+		p++;
+		for (i = 0; i < nr_columns; i++) {
+			unsigned long long val = strtoull(p, &end, 10);
+
+			if (end == p)
+				break;
+			p = end;
+			if (column_cpu[i] >= 0 && column_cpu[i] < audit->nr_cpus)
+				counts[column_cpu[i] * NR_IRQ_KINDS + kind] += val;
+		}
+	}
+	return 0;
+}
+
+int init_irq_audit(Irq_audit_t *audit, unsigned int nr_cpus)
+{
+	int ret;
+
+	memset(audit, 0, sizeof(*audit));
+	audit->nr_cpus = nr_cpus;
+	audit->size = IRQ_BUF_SIZE;
+	audit->buf = (char *)malloc(audit->size);
+	audit->start = (unsigned long long *)calloc(nr_cpus * NR_IRQ_KINDS,
+						sizeof(unsigned long long));
+	audit->end = (unsigned long long *)calloc(nr_cpus * NR_IRQ_KINDS,
+						sizeof(unsigned long long));
+	if (!audit->buf || !audit->start || !audit->end) {
+		printf("alloc mem for irq audit failed\n");
+		return -ENOMEM;
+	}
+	ret = irq_audit_read(audit, audit->start);
+	if (ret < 0) {
+		printf("Need to support %s\n", INTERRUPTS_PATH);
+		return ret;
+	}
+	audit->start_ns = monotonic_ns();
+	return 0;
+}
+
+/* IPIs @cpus received since init_irq_audit(), as totals and per second */
+void irq_audit_report(Irq_audit_t *audit, const cpumask_t *cpus)
+{
+	unsigned long long ns;
+	int cpu, kind;
+
+	if (irq_audit_read(audit, audit->end) < 0)
+		return;
+	ns = monotonic_ns() - audit->start_ns;
+
+	printf("irq\tcpu");
+	for (kind = 0; kind < NR_IRQ_KINDS; kind++)
+		printf("\t%s", irq_short[kind]);
+	for (kind = 0; kind < NR_IRQ_KINDS; kind++)
+		printf("\t%s/s", irq_short[kind]);
+	printf("\n");
+	for_each_cpu_mask(cpu, *cpus) {
+		unsigned long long delta[NR_IRQ_KINDS];
+
+		if (cpu >= audit->nr_cpus)
+			break;
+		printf("irq\t%d", cpu);
+		for (kind = 0; kind < NR_IRQ_KINDS; kind++) {
+			int i = cpu * NR_IRQ_KINDS + kind;
+
+			delta[kind] = audit->end[i] >= audit->start[i] ?
+				audit->end[i] - audit->start[i] : 0;
+			printf("\t%llu", delta[kind]);
+		}
+		for (kind = 0; kind < NR_IRQ_KINDS; kind++)
+			printf("\t%.1f", ns ? (double)delta[kind] *
+					NSEC_PER_SEC / ns : 0.0);
+		printf("\n");
+	}
+}
+
+void destroy_irq_audit(Irq_audit_t *audit)
+{
+	free(audit->buf);
+	free(audit->start);
+	free(audit->end);
+	memset(audit, 0, sizeof(*audit));
+}
@@ -0,0 +1,56 @@
+#ifndef _ISOLATION_H_
+#define _ISOLATION_H_
+
+#include <stddef.h>
+
+#include "cpumask.h"
+
+/*
+ * Cpus the monitor must not disturb.  isolcpus= and nohz_full= cores run
+ * latency critical work, so per cpu sources that IPI them are avoided
+ * there and our own threads stay on the housekeeping cpus.
+ */
+typedef struct isolation {
+	cpumask_t	isolated;
+	cpumask_t	nohz_full;
+	cpumask_t	quiet;		//isolated | nohz_full
+	cpumask_t	housekeeping;	//online and not quiet
+}Isolation_t;
+
+enum irq_kind {
+	IRQ_CALL = 0,		//function call IPIs
+	IRQ_RESCHED,		//rescheduling IPIs
+	IRQ_TLB,		//TLB shootdowns
+	NR_IRQ_KINDS
+};
+
+/* /proc/interrupts IPI counts per cpu at start and exit, for --irq-audit */
+typedef struct irq_audit {
+	unsigned int	nr_cpus;
+	unsigned long long *start;	//[cpu * NR_IRQ_KINDS + kind]
+	unsigned long long *end;
+	unsigned long long start_ns;
+	char		*buf;
+	size_t		size;
+}Irq_audit_t;
+
+/* Tick to tick intervals, to compare the perturbation settings */
+typedef struct jitter {
+	unsigned long long last_ns;	//CLOCK_MONOTONIC of the last tick
+	unsigned int	count;
+	double		mean, m2;	//Welford running mean and sum of squares
+	double		min, max;
+}Jitter_t;
+
+int init_isolation(Isolation_t *iso);
+int isolation_pin(const cpumask_t *cpus);
+int isolation_set_sched(const char *policy);
+int isolation_lock_memory(void);
+int isolation_timer_slack(unsigned long ns);
+void jitter_record(Jitter_t *jitter, unsigned long long now);
+void jitter_report(const Jitter_t *jitter, const char *mode);
+int init_irq_audit(Irq_audit_t *audit, unsigned int nr_cpus);
+void irq_audit_report(Irq_audit_t *audit, const cpumask_t *cpus);
+void destroy_irq_audit(Irq_audit_t *audit);
+
+#endif
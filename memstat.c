@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "system_monitor.h"
+#include "memstat.h"
+
+#define KV_BUF_SIZE	8192
+
+static const char * const meminfo_keys[NR_MEMINFO_SLOTS] = {
+	[MEMINFO_TOTAL]		= "MemTotal",
+	[MEMINFO_FREE]		= "MemFree",
+	[MEMINFO_AVAILABLE]	= "MemAvailable",
+	[MEMINFO_BUFFERS]	= "Buffers",
+	[MEMINFO_CACHED]	= "Cached",
+	[MEMINFO_SWAP_TOTAL]	= "SwapTotal",
+	[MEMINFO_SWAP_FREE]	= "SwapFree",
+	[MEMINFO_DIRTY]		= "Dirty",
+	[MEMINFO_WRITEBACK]	= "Writeback",
+};
+
+static const char * const vmstat_keys[NR_VMSTAT_SLOTS] = {
+	[VMSTAT_PGFAULT]	= "pgfault",
+	[VMSTAT_PGMAJFAULT]	= "pgmajfault",
+	[VMSTAT_PSWPIN]		= "pswpin",
+	[VMSTAT_PSWPOUT]	= "pswpout",
+	[VMSTAT_PGSCAN_KSWAPD]	= "pgscan_kswapd",
+	[VMSTAT_PGSCAN_DIRECT]	= "pgscan_direct",
+	[VMSTAT_OOM_KILL]	= "oom_kill",
+};
+
+static const char * const psi_names[NR_PSI_RESOURCES] = {
+	[PSI_CPU]	= "cpu",
+	[PSI_MEMORY]	= "memory",
+	[PSI_IO]	= "io",
+};
+
+/* Zero @mem with every descriptor at -1, the "not open" value */
+static void memstat_clear(Memstat_t *mem)
+{
+	int i;
+
+	memset(mem, 0, sizeof(*mem));
+	mem->meminfo.fd = mem->vmstat.fd = -1;
+	for (i = 0; i < NR_PSI_RESOURCES; i++)
+		mem->psi[i].fd = -1;
+}
+
+static int kv_init(Kv_file_t *kv, const char *path,
+			const char * const *keys, unsigned int nr_keys)
+{
+	char root[PATH_MAX];
+
+	memset(kv, 0, sizeof(*kv));
+	kv->path = path;
+	kv->keys = keys;
+	kv->nr_keys = nr_keys;
+	kv->size = KV_BUF_SIZE;
+
+	root_path(root, PATH_MAX, "%s", path);
+	kv->fd = open(root, O_RDONLY | O_CLOEXEC);
+	if (kv->fd < 0) {
+		printf("Need to support %s\n", path);
+		return -EINVAL;
+	}
+
+	kv->buf = (char *)malloc(kv->size);
+	kv->line = (int *)malloc(nr_keys * sizeof(int));
+	kv->offset = (int *)malloc(nr_keys * sizeof(int));
+	kv->order = (int *)malloc(nr_keys * sizeof(int));
+	kv->cur = (unsigned long long *)calloc(nr_keys, sizeof(unsigned long long));
+	kv->prev = (unsigned long long *)calloc(nr_keys, sizeof(unsigned long long));
+	if (!kv->buf || !kv->line || !kv->offset || !kv->order
+		|| !kv->cur || !kv->prev) {
+		printf("alloc mem for %s failed\n", path);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/* Learn line index and the column past every key from kv->buf */
+static void kv_build_layout(Kv_file_t *kv)
+{
+	char *line = kv->buf;
+	int nr = 0, found = 0;
+	int i, j;
+
+	for (i = 0; i < kv->nr_keys; i++)
+		kv->line[i] = -1;
+
+	while (*line) {
+		size_t keylen = strcspn(line, ": \t\n");
+		char *next;
+
+		for (i = 0; i < kv->nr_keys; i++) {
+			char *p;
+
+			if (kv->line[i] >= 0 || strlen(kv->keys[i]) != keylen ||
+			    strncmp(line, kv->keys[i], keylen))
+				continue;
+			/*
+			 * meminfo right aligns its values, so one that gains a
+			 * digit starts a column earlier: keep the column past
+			 * the key and let strtoull() skip the padding
+			 */
+			p = line + keylen;
+			if (*p == ':')
+				p++;
+			kv->line[i] = nr;
+			kv->offset[i] = p - line;
+			/* keep order[] sorted by line index */
+			for (j = found; j > 0 && kv->line[kv->order[j - 1]] > nr; j--)
+				kv->order[j] = kv->order[j - 1];
+			kv->order[j] = i;
+			found++;
+			break;
+		}
+
+		next = strchr(line, '\n');
+		if (!next)
+			break;
+		line = next + 1;
+		nr++;
+	}
+
+	/* order[] past the found keys is unused, mark the end */
+	if (found < kv->nr_keys)
+		kv->order[found] = -1;
+	kv->nr_lines = nr;
+}
+
+/*
+ * Walk to the known lines only and convert the number after the key.
+ * Returns -EAGAIN if a key moved, the caller then rebuilds the layout.
+ */
+static int kv_parse(Kv_file_t *kv)
+{
+	char *line = kv->buf;
+	int nr = 0, k = 0;
+
+	while (k < kv->nr_keys && kv->order[k] >= 0) {
+		int slot = kv->order[k];
+
+		if (nr == kv->line[slot]) {
+			size_t keylen = strlen(kv->keys[slot]);
+
+			if (strncmp(line, kv->keys[slot], keylen) ||
+			    (line[keylen] != ':' && line[keylen] != ' '))
+				return -EAGAIN;
+			kv->cur[slot] = strtoull(line + kv->offset[slot], NULL, 10);
+			k++;
+			continue;
+		}
+		line = strchr(line, '\n');
+		if (!line)
+			return -EAGAIN;
+		line++;
+		nr++;
+	}
+	return 0;
+}
+
+static int kv_sample(Kv_file_t *kv)
+{
+	unsigned long long *tmp;
+	int ret;
+
+	ret = pread_whole_file(kv->fd, &kv->buf, &kv->size);
+	if (ret < 0)
+		return ret;
+
+	tmp = kv->prev;
+	kv->prev = kv->cur;
+	kv->cur = tmp;
+
+	if (!kv->nr_lines || kv_parse(kv) < 0) {
+		kv_build_layout(kv);
+		kv_parse(kv);
+	}
+	return 0;
+}
+
+static void kv_destroy(Kv_file_t *kv)
+{
+	if (kv->fd >= 0)
+		close(kv->fd);
+	free(kv->buf);
+	free(kv->line);
+	free(kv->offset);
+	free(kv->order);
+	free(kv->cur);
+	free(kv->prev);
+}
+
+static unsigned int psi_permille(unsigned long long stall_us,
+				unsigned long long elapsed_us)
+{
+	if (stall_us >= elapsed_us)
+		return 1000;
+	return (unsigned int)(1000 * stall_us / elapsed_us);
+}
+
+static int psi_sample(Psi_stat_t *psi, unsigned long long elapsed_ns)
+{
+	static const char fmt[] = "some avg10=%lf avg60=%*f avg300=%*f total=%llu "
+				"full avg10=%lf avg60=%*f avg300=%*f total=%llu";
+	unsigned long long elapsed_us = elapsed_ns / NSEC_PER_USEC;
+	char buf[256];
+	int ret;
+
+	if (psi->fd < 0 || pread_one_line(psi->fd, buf, sizeof(buf)) <= 0)
+		return -EINVAL;
+
+	psi->prev_some_total = psi->some_total;
+	psi->prev_full_total = psi->full_total;
+	ret = sscanf(buf, fmt, &psi->some_avg10, &psi->some_total,
+			&psi->full_avg10, &psi->full_total);
+	if (ret < 2)
+		return -EINVAL;
+
+	psi->some = psi->full = 0;
+	if (!elapsed_us)
+		return 0;
+	if (psi->prev_some_total && psi->some_total >= psi->prev_some_total)
+		psi->some = psi_permille(psi->some_total - psi->prev_some_total,
+					elapsed_us);
+	if (ret == 4 && psi->prev_full_total &&
+	    psi->full_total >= psi->prev_full_total)
+		psi->full = psi_permille(psi->full_total - psi->prev_full_total,
+					elapsed_us);
+	return 0;
+}
+
+int init_memstat(Memstat_t *mem)
+{
+	char path[PATH_MAX];
+	int i, ret;
+
+	memstat_clear(mem);
+	ret = kv_init(&mem->meminfo, MEMINFO_PATH, meminfo_keys, NR_MEMINFO_SLOTS);
+	if (ret < 0)
+		return ret;
+	ret = kv_init(&mem->vmstat, VMSTAT_PATH, vmstat_keys, NR_VMSTAT_SLOTS);
+	if (ret < 0)
+		return ret;
+
+	/* PSI needs CONFIG_PSI, go on without it */
+	for (i = 0; i < NR_PSI_RESOURCES; i++) {
+		root_path(path, PATH_MAX, PSI_PATH "/%s", psi_names[i]);
+		mem->psi[i].fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+	return 0;
+}
+
+int memstat_sample(Memstat_t *mem)
+{
+	unsigned long long now;
+	int i, ret;
+
+	now = monotonic_ns();
+	mem->elapsed_ns = mem->last_ns ? now - mem->last_ns : 0;
+	mem->last_ns = now;
+
+	ret = kv_sample(&mem->meminfo);
+	if (ret < 0)
+		return ret;
+	ret = kv_sample(&mem->vmstat);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < NR_VMSTAT_SLOTS; i++) {
+		unsigned long long cur = mem->vmstat.cur[i];
+		unsigned long long prev = mem->vmstat.prev[i];
+
+		if (!mem->elapsed_ns || cur < prev)
+			mem->rate[i] = 0;
+		else
+			mem->rate[i] = (cur - prev) * NSEC_PER_SEC / mem->elapsed_ns;
+	}
+
+	for (i = 0; i < NR_PSI_RESOURCES; i++)
+		psi_sample(&mem->psi[i], mem->elapsed_ns);
+
+	return 0;
+}
+
+void destroy_memstat(Memstat_t *mem)
+{
+	int i;
+
+	kv_destroy(&mem->meminfo);
+	kv_destroy(&mem->vmstat);
+	for (i = 0; i < NR_PSI_RESOURCES; i++)
+		if (mem->psi[i].fd >= 0)
+			close(mem->psi[i].fd);
+	memstat_clear(mem);
+}
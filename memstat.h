@@ -0,0 +1,75 @@
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+/* Slots of the /proc/meminfo values we keep, in kB */
+enum meminfo_slot {
+	MEMINFO_TOTAL = 0,
+	MEMINFO_FREE,
+	MEMINFO_AVAILABLE,
+	MEMINFO_BUFFERS,
+	MEMINFO_CACHED,
+	MEMINFO_SWAP_TOTAL,
+	MEMINFO_SWAP_FREE,
+	MEMINFO_DIRTY,
+	MEMINFO_WRITEBACK,
+	NR_MEMINFO_SLOTS
+};
+
+/* Slots of the /proc/vmstat event counters we turn into rates */
+enum vmstat_slot {
+	VMSTAT_PGFAULT = 0,
+	VMSTAT_PGMAJFAULT,
+	VMSTAT_PSWPIN,
+	VMSTAT_PSWPOUT,
+	VMSTAT_PGSCAN_KSWAPD,
+	VMSTAT_PGSCAN_DIRECT,
+	VMSTAT_OOM_KILL,
+	NR_VMSTAT_SLOTS
+};
+
+enum psi_resource {
+	PSI_CPU = 0,
+	PSI_MEMORY,
+	PSI_IO,
+	NR_PSI_RESOURCES
+};
+
+/*
+ * A "key value" proc file.  The line and column of every wanted key is
+ * learned on the first read, later reads only convert the numbers there.
+ */
+typedef struct kv_file {
+	const char	*path;
+	const char * const *keys;		//key names, indexed by slot
+	unsigned int	nr_keys;
+	int		fd;
+	char		*buf;			//read buffer reused across ticks
+	size_t		size;
+	unsigned int	nr_lines;		//line count the layout was built on
+	int		*line;			//slot -> line index, -1 if absent
+	int		*offset;		//slot -> column past the key in its line
+	int		*order;			//slots sorted by line index
+	unsigned long long *cur, *prev;		//values, double buffered
+}Kv_file_t;
+
+typedef struct psi_stat {
+	int		fd;
+	double		some_avg10, full_avg10;
+	unsigned long long some_total, full_total;	//cumulative stall (us)
+	unsigned long long prev_some_total, prev_full_total;
+	unsigned int	some, full;		//stall over the tick, 0.1%
+}Psi_stat_t;
+
+typedef struct memstat {
+	Kv_file_t	meminfo;
+	Kv_file_t	vmstat;
+	Psi_stat_t	psi[NR_PSI_RESOURCES];
+	unsigned long long rate[NR_VMSTAT_SLOTS];	//events per second
+	unsigned long long last_ns, elapsed_ns;
+}Memstat_t;
+
+int init_memstat(Memstat_t *mem);
+int memstat_sample(Memstat_t *mem);
+void destroy_memstat(Memstat_t *mem);
+
+#endif
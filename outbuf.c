@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include "outbuf.h"
+
+int outbuf_init(Outbuf_t *ob, size_t size)
+{
+	ob->len = 0;
+	ob->size = size ? size : 1;
+	ob->buf = (char *)malloc(ob->size);
+	if (!ob->buf) {
+		ob->size = 0;
+		return -ENOMEM;
+	}
+	ob->buf[0] = '\0';
+	return 0;
+}
+
+/* Make room for @len more bytes plus the trailing '\0' */
+int outbuf_reserve(Outbuf_t *ob, size_t len)
+{
+	size_t size = ob->size ? ob->size : 64;
+	char *buf;
+
+	if (ob->len + len + 1 <= ob->size)
+		return 0;
+	while (ob->len + len + 1 > size)
+		size *= 2;
+	buf = realloc(ob->buf, size);
+	if (!buf)
+		return -ENOMEM;
+	ob->buf = buf;
+	ob->size = size;
+	return 0;
+}
+
+int outbuf_printf(Outbuf_t *ob, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return len;
+
+	if (ob->len + len + 1 > ob->size) {
+		if (outbuf_reserve(ob, len) < 0) {
+			if (ob->buf)
+				ob->buf[ob->len] = '\0';
+			return -ENOMEM;
+		}
+		va_start(ap, fmt);
+		vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+		va_end(ap);
+	}
+	ob->len += len;
+	return len;
+}
+
+int outbuf_write(Outbuf_t *ob, const char *data, size_t len)
+{
+	if (outbuf_reserve(ob, len) < 0)
+		return -ENOMEM;
+	memcpy(ob->buf + ob->len, data, len);
+	ob->len += len;
+	ob->buf[ob->len] = '\0';
+	return len;
+}
+
+int outbuf_copy(Outbuf_t *dst, const Outbuf_t *src)
+{
+	outbuf_reset(dst);
+	return outbuf_write(dst, src->buf, src->len);
+}
+
+void outbuf_flush(Outbuf_t *ob, FILE *file)
+{
+	if (ob->len)
+		fwrite(ob->buf, 1, ob->len, file);
+	fflush(file);
+	outbuf_reset(ob);
+}
+
+void destroy_outbuf(Outbuf_t *ob)
+{
+	free(ob->buf);
+	memset(ob, 0, sizeof(*ob));
+}
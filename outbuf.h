@@ -0,0 +1,33 @@
+#ifndef _OUTBUF_H_
+#define _OUTBUF_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Growable text buffer the display code renders a tick into, so the same
+ * output can go to stdout, a socket or the history ring.
+ */
+typedef struct outbuf {
+	char	*buf;
+	size_t	len;
+	size_t	size;
+}Outbuf_t;
+
+int outbuf_init(Outbuf_t *ob, size_t size);
+int outbuf_reserve(Outbuf_t *ob, size_t len);
+int outbuf_printf(Outbuf_t *ob, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int outbuf_write(Outbuf_t *ob, const char *data, size_t len);
+int outbuf_copy(Outbuf_t *dst, const Outbuf_t *src);
+void outbuf_flush(Outbuf_t *ob, FILE *file);
+void destroy_outbuf(Outbuf_t *ob);
+
+static inline void outbuf_reset(Outbuf_t *ob)
+{
+	ob->len = 0;
+	if (ob->buf)
+		ob->buf[0] = '\0';
+}
+
+#endif
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "cpumask.h"
+#include "system_monitor.h"
+#include "perfstat.h"
+
+/*
+ * One counter group per online cpu, read in PERF_FORMAT_GROUP so a single
+ * read() per cpu returns every counter of the same interval:
+ *   u64 nr, time_enabled, time_running, value[nr]
+ */
+#define PERF_READ_FORMAT	(PERF_FORMAT_GROUP | \
+				 PERF_FORMAT_TOTAL_TIME_ENABLED | \
+				 PERF_FORMAT_TOTAL_TIME_RUNNING)
+
+typedef struct perf_event_desc {
+	unsigned int		type;
+	unsigned long long	config;
+}Perf_event_desc_t;
+
+static const Perf_event_desc_t hw_events[NR_PERF_COUNTERS] = {
+	[PERF_CYCLES]		= { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS]	= { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CACHE_MISSES]	= { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_CTX_SWITCHES]	= { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* VMs and CI runners without a PMU: cpu-clock leads, no IPC/MPKI */
+static const Perf_event_desc_t sw_events[NR_PERF_COUNTERS] = {
+	[PERF_CYCLES]		= { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+	[PERF_INSTRUCTIONS]	= { PERF_TYPE_MAX, 0 },
+	[PERF_CACHE_MISSES]	= { PERF_TYPE_MAX, 0 },
+	[PERF_CTX_SWITCHES]	= { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+static int perf_open(const Perf_event_desc_t *desc, int cpu, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = desc->type;
+	attr.config = desc->config;
+	attr.read_format = PERF_READ_FORMAT;
+	/* the group starts counting once all members are in */
+	attr.disabled = group_fd < 0;
+	return syscall(SYS_perf_event_open, &attr, -1, cpu, group_fd,
+			PERF_FLAG_FD_CLOEXEC);
+}
+
+static void perf_close_cpu(Perf_cpu_t *c)
+{
+	int i;
+
+	/* members first, the leader owns the group */
+	for (i = NR_PERF_COUNTERS - 1; i >= 0; i--) {
+		if (c->fd[i] >= 0)
+			close(c->fd[i]);
+		c->fd[i] = -1;
+		c->slot[i] = -1;
+	}
+}
+
+static int perf_open_cpu(Perfstat_t *perf, int cpu)
+{
+	const Perf_event_desc_t *events = perf->software ? sw_events : hw_events;
+	Perf_cpu_t *c = &perf->cpus[cpu];
+	int i, nr = 0;
+
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		if (events[i].type == PERF_TYPE_MAX)
+			continue;
+		c->fd[i] = perf_open(&events[i], cpu,
+				i == PERF_CYCLES ? -1 : c->fd[PERF_CYCLES]);
+		if (c->fd[i] < 0) {
+			if (i == PERF_CYCLES)
+				return -errno;
+			/* e.g. no cache-misses on this PMU, the rest still count */
+			continue;
+		}
+		c->slot[i] = nr++;
+	}
+	if (ioctl(c->fd[PERF_CYCLES], PERF_EVENT_IOC_ENABLE,
+			PERF_IOC_FLAG_GROUP) < 0) {
+		perf_close_cpu(c);
+		return -errno;
+	}
+	return 0;
+}
+
+int init_perfstat(Perfstat_t *perf, unsigned int nr_cpus)
+{
+	int cpu, i, fd;
+
+	memset(perf, 0, sizeof(*perf));
+	perf->nr_cpus = nr_cpus;
+	perf->cpus = (Perf_cpu_t *)calloc(nr_cpus, sizeof(Perf_cpu_t));
+	if (!perf->cpus) {
+		printf("alloc mem for perf counters failed\n");
+		return -ENOMEM;
+	}
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		for (i = 0; i < NR_PERF_COUNTERS; i++) {
+			perf->cpus[cpu].fd[i] = -1;
+			perf->cpus[cpu].slot[i] = -1;
+		}
+
+	/* Probe on cpu 0: hardware cycles, else the software group */
+	fd = perf_open(&hw_events[PERF_CYCLES], 0, -1);
+	if (fd < 0) {
+		fd = perf_open(&sw_events[PERF_CYCLES], 0, -1);
+		if (fd < 0) {
+			printf("perf_event_open failed:%s, check "
+				"/proc/sys/kernel/perf_event_paranoid\n",
+				strerror(errno));
+			return -errno;
+		}
+		perf->software = 1;
+		printf("No hardware perf events, using software counters\n");
+	}
+	close(fd);
+
+	/* four descriptors per cpu */
+	raise_nofile_limit();
+	return 0;
+}
+
+/*
+ * Read the group of every online cpu but the skipped ones, opening it the
+ * first time the cpu is seen online, and derive IPC, MPKI and the context
+ * switch rate.
+ */
+void perfstat_sample(Perfstat_t *perf)
+{
+	unsigned long long buf[3 + NR_PERF_COUNTERS];
+	unsigned long long now, elapsed_ns;
+	int cpu, i;
+
+	now = monotonic_ns();
+	elapsed_ns = perf->last_ns ? now - perf->last_ns : 0;
+	perf->last_ns = now;
+
+	for_each_online_cpu(cpu) {
+		unsigned long long enabled, running;
+		Perf_cpu_t *c;
+		ssize_t nread;
+
+		if (cpu >= perf->nr_cpus)
+			break;
+		c = &perf->cpus[cpu];
+		if (c->fd[PERF_CYCLES] < 0) {
+			if (c->failed || cpu_isset(cpu, perf->skip))
+				continue;
+			if (perf_open_cpu(perf, cpu) < 0) {
+				c->failed = 1;
+				continue;
+			}
+		}
+
+		nread = read(c->fd[PERF_CYCLES], buf, sizeof(buf));
+		if (nread < (ssize_t)(3 * sizeof(buf[0])))
+			continue;
+
+		enabled = buf[1] - c->enabled;
+		running = buf[2] - c->running;
+		c->enabled = buf[1];
+		c->running = buf[2];
+		for (i = 0; i < NR_PERF_COUNTERS; i++) {
+			unsigned long long value, delta;
+
+			if (c->slot[i] < 0 ||
+			    (unsigned long long)c->slot[i] >= buf[0]) {
+				c->delta[i] = 0;
+				continue;
+			}
+			value = buf[3 + c->slot[i]];
+			delta = value - c->value[i];
+			c->value[i] = value;
+			/* the group shared the PMU part of the interval */
+			if (running && running < enabled)
+				delta = (unsigned long long)((double)delta *
+						enabled / running);
+			c->delta[i] = delta;
+		}
+
+		c->ipc = c->delta[PERF_CYCLES] && !perf->software ?
+			100 * c->delta[PERF_INSTRUCTIONS] / c->delta[PERF_CYCLES] : 0;
+		c->mpki = c->delta[PERF_INSTRUCTIONS] ?
+			100000 * c->delta[PERF_CACHE_MISSES] /
+				c->delta[PERF_INSTRUCTIONS] : 0;
+		c->ctx_rate = elapsed_ns ? c->delta[PERF_CTX_SWITCHES] *
+				NSEC_PER_SEC / elapsed_ns : 0;
+	}
+}
+
+void destroy_perfstat(Perfstat_t *perf)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < perf->nr_cpus && perf->cpus; cpu++)
+		perf_close_cpu(&perf->cpus[cpu]);
+	free(perf->cpus);
+	memset(perf, 0, sizeof(*perf));
+}
@@ -0,0 +1,38 @@
+#ifndef _PERFSTAT_H_
+#define _PERFSTAT_H_
+
+#include "cpumask.h"
+
+enum perf_counter {
+	PERF_CYCLES = 0,	//cpu-clock ns in software mode
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_CTX_SWITCHES,
+	NR_PERF_COUNTERS,
+};
+
+typedef struct perf_cpu {
+	int		fd[NR_PERF_COUNTERS];	//group leader is fd[PERF_CYCLES]
+	int		slot[NR_PERF_COUNTERS];	//counter -> group read index, -1 absent
+	int		failed;			//leader did not open, not retried
+	unsigned long long value[NR_PERF_COUNTERS];	//raw cumulative counts
+	unsigned long long enabled, running;	//group times, for multiplexing
+	unsigned long long delta[NR_PERF_COUNTERS];	//last tick, scaled to enabled
+	unsigned int	ipc;			//instructions per cycle, 0.01 units
+	unsigned int	mpki;			//misses per 1000 instructions, 0.01 units
+	unsigned int	ctx_rate;		//context switches per second
+}Perf_cpu_t;
+
+typedef struct perfstat {
+	unsigned int	nr_cpus;
+	int		software;	//no hardware events, cpu-clock group
+	cpumask_t	skip;		//never opened, reading a group IPIs its cpu
+	Perf_cpu_t	*cpus;
+	unsigned long long last_ns;	//CLOCK_MONOTONIC of the last sample
+}Perfstat_t;
+
+int init_perfstat(Perfstat_t *perf, unsigned int nr_cpus);
+void perfstat_sample(Perfstat_t *perf);
+void destroy_perfstat(Perfstat_t *perf);
+
+#endif
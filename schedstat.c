@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "system_monitor.h"
+#include "schedstat.h"
+
+#define SCHEDSTAT_BUF_SIZE	16384
+#define SCHEDSTAT_MIN_VERSION	10
+
+/*
+ *   version 15
+ *   timestamp 4297299139
+ *   cpu0 0 0 2340 1068 1113 535 1587163536 83196447 1272
+ *   domain0 00000003 ...
+ *
+ * The cpu line has changed over the versions, but rq_cpu_time, run_delay
+ * and pcount have stayed its last three numbers since version 10.
+ */
+static int schedstat_build_layout(Schedstat_t *sched)
+{
+	char *line = sched->buf, *p, *end;
+	int version = 0;
+	unsigned int nr;
+
+	for (; line; line = (p = strchr(line, '\n')) ? p + 1 : NULL) {
+		if (!strncmp(line, "version ", strlen("version ")))
+			version = atoi(line + strlen("version "));
+		else if (!strncmp(line, "cpu", strlen("cpu")))
+			break;
+	}
+	if (!line || version < SCHEDSTAT_MIN_VERSION) {
+		printf("Unsupported %s version:%d\n", SCHEDSTAT_PATH, version);
+		return -EINVAL;
+	}
+
+	p = line + strcspn(line, " \n");
+	for (nr = 0; ; nr++) {
+		strtoull(p, &end, 10);
+		if (end == p)
+			break;
+		p = end;
+	}
+	if (nr < 3) {
+		printf("Unsupported %s layout\n", SCHEDSTAT_PATH);
+		return -EINVAL;
+	}
+	sched->version = version;
+	sched->nr_fields = nr;
+	sched->time_field = nr - 3;
+	sched->delay_field = nr - 2;
+	sched->pcount_field = nr - 1;
+	return 0;
+}
+
+/*
+ * Convert run_delay and pcount of every cpu line at the learned columns.
+ * Returns -EAGAIN on a line that does not fit the layout.
+ */
+static int schedstat_parse(Schedstat_t *sched)
+{
+	char *line, *p, *end;
+	unsigned int cpu, i;
+
+	for (line = sched->buf; line; line = (p = strchr(line, '\n')) ? p + 1 : NULL) {
+		Schedstat_cpu_t *c;
+
+		/* domain lines dominate the file, skip them on the first byte */
+		if (line[0] != 'c' || strncmp(line, "cpu", strlen("cpu")))
+			continue;
+		cpu = strtoul(line + strlen("cpu"), &p, 10);
+		if (cpu >= sched->nr_cpus)
+			continue;
+		c = &sched->cpus[cpu];
+		for (i = 0; i <= sched->pcount_field; i++) {
+			unsigned long long val = strtoull(p, &end, 10);
+
+			if (end == p)
+				return -EAGAIN;
+			p = end;
+			if (i == sched->time_field)
+				c->cpu_time = val;
+			else if (i == sched->delay_field)
+				c->run_delay = val;
+			else if (i == sched->pcount_field)
+				c->pcount = val;
+		}
+	}
+	return 0;
+}
+
+int init_schedstat(Schedstat_t *sched, unsigned int nr_cpus)
+{
+	char path[PATH_MAX];
+
+	memset(sched, 0, sizeof(*sched));
+	sched->nr_cpus = nr_cpus;
+	root_path(path, PATH_MAX, SCHEDSTAT_PATH);
+	sched->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (sched->fd < 0) {
+		printf("Need to support %s (CONFIG_SCHEDSTATS)\n", SCHEDSTAT_PATH);
+		return -EINVAL;
+	}
+
+	sched->size = SCHEDSTAT_BUF_SIZE;
+	sched->buf = (char *)malloc(sched->size);
+	sched->cpus = (Schedstat_cpu_t *)calloc(nr_cpus, sizeof(Schedstat_cpu_t));
+	if (!sched->buf || !sched->cpus) {
+		printf("alloc mem for schedstat failed\n");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/*
+ * Turn the run_delay and timeslice deltas into the average wait per
+ * timeslice and the run queue pressure, the average number of tasks
+ * that were runnable but waiting over the interval.  rq_cpu_time gives
+ * a ns precision busy share on the side.
+ */
+int schedstat_sample(Schedstat_t *sched)
+{
+	unsigned long long now, elapsed_ns;
+	unsigned int cpu;
+	int ret;
+
+	now = monotonic_ns();
+	elapsed_ns = sched->last_ns ? now - sched->last_ns : 0;
+	sched->last_ns = now;
+
+	ret = pread_whole_file(sched->fd, &sched->buf, &sched->size);
+	if (ret < 0)
+		return ret;
+
+	for (cpu = 0; cpu < sched->nr_cpus; cpu++) {
+		sched->cpus[cpu].prev_run_delay = sched->cpus[cpu].run_delay;
+		sched->cpus[cpu].prev_pcount = sched->cpus[cpu].pcount;
+		sched->cpus[cpu].prev_cpu_time = sched->cpus[cpu].cpu_time;
+	}
+	if (!sched->version || schedstat_parse(sched) < 0) {
+		ret = schedstat_build_layout(sched);
+		if (ret < 0)
+			return ret;
+		schedstat_parse(sched);
+	}
+
+	for (cpu = 0; cpu < sched->nr_cpus; cpu++) {
+		Schedstat_cpu_t *c = &sched->cpus[cpu];
+		unsigned long long delay, slices;
+
+		/* counters restart when a cpu is hotplugged */
+		if (!elapsed_ns || c->run_delay < c->prev_run_delay ||
+		    c->pcount < c->prev_pcount || c->cpu_time < c->prev_cpu_time) {
+			c->wait_us = c->rq_pressure = c->slice_rate = 0;
+			c->busy = -1;
+			continue;
+		}
+		slices = c->pcount - c->prev_pcount;
+		/*
+		 * rq_cpu_time is added when a task is switched out, so with
+		 * no switch in the interval it says nothing about a cpu that
+		 * ran one task throughout
+		 */
+		delay = c->cpu_time - c->prev_cpu_time;
+		if (!slices)
+			c->busy = -1;
+		else
+			c->busy = delay >= elapsed_ns ? 1000 : 1000 * delay / elapsed_ns;
+		delay = c->run_delay - c->prev_run_delay;
+		c->wait_us = slices ? delay / slices / NSEC_PER_USEC : 0;
+		c->rq_pressure = 100 * delay / elapsed_ns;
+		c->slice_rate = slices * NSEC_PER_SEC / elapsed_ns;
+	}
+	return 0;
+}
+
+void destroy_schedstat(Schedstat_t *sched)
+{
+	if (sched->fd > 0)
+		close(sched->fd);
+	free(sched->buf);
+	free(sched->cpus);
+	memset(sched, 0, sizeof(*sched));
+}
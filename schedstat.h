@@ -0,0 +1,39 @@
+#ifndef _SCHEDSTAT_H_
+#define _SCHEDSTAT_H_
+
+#include <stddef.h>
+
+typedef struct schedstat_cpu {
+	unsigned long long run_delay, pcount;	//cumulative ns waited, timeslices
+	unsigned long long prev_run_delay, prev_pcount;
+	unsigned long long cpu_time, prev_cpu_time;	//cumulative ns tasks ran
+	int		busy;		//cpu_time share of the interval, 0.1% units, -1 unknown
+	unsigned int	wait_us;	//average wait per timeslice of the last tick
+	unsigned int	rq_pressure;	//tasks waiting on average, 0.01 units
+	unsigned int	slice_rate;	//timeslices per second
+}Schedstat_cpu_t;
+
+/*
+ * /proc/schedstat, the field layout of the "cpuN" lines is learned from
+ * the version line and the first cpu line, later reads only convert the
+ * run_delay and timeslice fields.
+ */
+typedef struct schedstat {
+	unsigned int	nr_cpus;
+	int		fd;
+	char		*buf;		//read buffer reused across ticks
+	size_t		size;
+	int		version;	//0 until the layout is learned
+	unsigned int	nr_fields;	//numbers after "cpuN"
+	unsigned int	time_field;	//index of rq_cpu_time among them
+	unsigned int	delay_field;	//index of run_delay
+	unsigned int	pcount_field;	//index of the timeslice count
+	Schedstat_cpu_t	*cpus;
+	unsigned long long last_ns;	//CLOCK_MONOTONIC of the last sample
+}Schedstat_t;
+
+int init_schedstat(Schedstat_t *sched, unsigned int nr_cpus);
+int schedstat_sample(Schedstat_t *sched);
+void destroy_schedstat(Schedstat_t *sched);
+
+#endif
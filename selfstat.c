@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "system_monitor.h"
+#include "selfstat.h"
+
+#ifdef SELF_STATS
+
+static const char *stage_name[NR_SELF_STAGES] = {
+	[SELF_STAGE_TEMP]	= "temp",
+	[SELF_STAGE_CPUFREQ]	= "cpufreq",
+	[SELF_STAGE_STAT]	= "stat",
+	[SELF_STAGE_DISPLAY]	= "display",
+};
+
+static Self_hist_t self_hist[NR_SELF_STAGES];
+static unsigned long long self_start_ns;
+
+static unsigned int self_hist_index(unsigned long long ns)
+{
+	unsigned int shift;
+
+	if (ns < SELF_HIST_SUB)
+		return ns;
+	shift = 63 - __builtin_clzll(ns);
+	if (shift > SELF_HIST_MAX_SHIFT)
+		return SELF_HIST_BUCKETS - 1;
+	/* the top SELF_HIST_SUB_BITS bits below the leading one pick the bucket */
+	return (shift - SELF_HIST_SUB_BITS + 1) * SELF_HIST_SUB +
+		((ns >> (shift - SELF_HIST_SUB_BITS)) & (SELF_HIST_SUB - 1));
+}
+
+/* Lower bound of bucket @idx, the inverse of self_hist_index() */
+static unsigned long long self_hist_value(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < SELF_HIST_SUB)
+		return idx;
+	shift = idx / SELF_HIST_SUB + SELF_HIST_SUB_BITS - 1;
+	return (1ULL << shift) |
+		((unsigned long long)(idx % SELF_HIST_SUB) << (shift - SELF_HIST_SUB_BITS));
+}
+
+void selfstat_record(int stage, unsigned long long ns, unsigned long long allocs)
+{
+	Self_hist_t *h = &self_hist[stage];
+
+	if (!self_start_ns)
+		self_start_ns = monotonic_ns() - ns;
+	h->count++;
+	h->sum_ns += ns;
+	h->allocs += allocs;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->bucket[self_hist_index(ns)]++;
+}
+
+static unsigned long long self_hist_quantile(const Self_hist_t *h, double q)
+{
+	unsigned long long rank = q * (h->count - 1);
+	unsigned long long seen = 0;
+	int i;
+
+	for (i = 0; i < SELF_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen > rank)
+			return self_hist_value(i);
+	}
+	return h->max_ns;
+}
+
+/*
+ * Per stage latency, then the cpu time of the whole process against the
+ * wall time since the first span: the monitor overhead on one core.
+ */
+void selfstat_report(void)
+{
+	struct rusage ru;
+	unsigned long long wall_ns, cpu_ns;
+	int i;
+
+	printf("self\tstage\tcount\tavg_ns\tp50_ns\tp99_ns\tmax_ns\tallocs\n");
+	for (i = 0; i < NR_SELF_STAGES; i++) {
+		const Self_hist_t *h = &self_hist[i];
+
+		if (!h->count)
+			continue;
+		printf("self\t%s\t%llu\t%llu\t%llu\t%llu\t%llu\t", stage_name[i],
+			h->count, h->sum_ns / h->count,
+			self_hist_quantile(h, 0.50), self_hist_quantile(h, 0.99),
+			h->max_ns);
+		/* allocations are only known under the allocount shim */
+		if (bench_alloc_count)
+			printf("%.2f\n", (double)h->allocs / h->count);
+		else
+			printf("-\n");
+	}
+
+	if (!self_start_ns || getrusage(RUSAGE_SELF, &ru) < 0)
+		return;
+	wall_ns = monotonic_ns() - self_start_ns;
+	cpu_ns = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * NSEC_PER_SEC +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * NSEC_PER_USEC;
+	printf("self\toverhead\tcpu:%llums\twall:%llums\tcore:%.4f%%\n",
+		cpu_ns / NSEC_PER_MSEC, wall_ns / NSEC_PER_MSEC,
+		wall_ns ? 100.0 * cpu_ns / wall_ns : 0.0);
+}
+
+#else
+
+void selfstat_report(void)
+{
+	printf("self stats not built in, rebuild with make SELF_STATS=1\n");
+}
+
+#endif
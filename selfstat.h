@@ -0,0 +1,79 @@
+#ifndef _SELFSTAT_H_
+#define _SELFSTAT_H_
+
+#include "system_monitor.h"
+
+/* Instrumented stages of a tick */
+enum self_stage {
+	SELF_STAGE_TEMP = 0,	//parse_system_master_temp_info()
+	SELF_STAGE_CPUFREQ,	//online/cpufreq loop of parse_cpu_info()
+	SELF_STAGE_STAT,	//do_stat()
+	SELF_STAGE_DISPLAY,	//display_system_info()
+	NR_SELF_STAGES
+};
+
+/*
+ * Log-linear histogram: 2^SELF_HIST_SUB_BITS linear buckets per power of
+ * two, a few % relative error from 1ns up to 2^SELF_HIST_MAX_SHIFT ns.
+ */
+#define SELF_HIST_SUB_BITS	3
+#define SELF_HIST_SUB		(1 << SELF_HIST_SUB_BITS)
+#define SELF_HIST_MAX_SHIFT	40
+#define SELF_HIST_BUCKETS	((SELF_HIST_MAX_SHIFT - SELF_HIST_SUB_BITS + 2) * SELF_HIST_SUB)
+
+#ifdef SELF_STATS
+
+typedef struct self_hist {
+	unsigned long long	count;
+	unsigned long long	sum_ns;
+	unsigned long long	max_ns;
+	unsigned long long	allocs;		//heap allocations inside the spans
+	unsigned int		bucket[SELF_HIST_BUCKETS];
+}Self_hist_t;
+
+typedef struct self_span {
+	unsigned long long	ns;
+	unsigned long long	allocs;
+}Self_span_t;
+
+/* Provided by the bench/allocount.so LD_PRELOAD shim when it is loaded */
+extern unsigned long long bench_alloc_count(void) __attribute__((weak));
+
+void selfstat_record(int stage, unsigned long long ns, unsigned long long allocs);
+
+static inline Self_span_t self_span_begin(void)
+{
+	Self_span_t span;
+
+	span.allocs = bench_alloc_count ? bench_alloc_count() : 0;
+	span.ns = monotonic_ns();
+	return span;
+}
+
+static inline void self_span_end(int stage, Self_span_t start)
+{
+	unsigned long long ns = monotonic_ns() - start.ns;
+
+	selfstat_record(stage, ns, bench_alloc_count ?
+			bench_alloc_count() - start.allocs : 0);
+}
+
+#else
+
+typedef int Self_span_t;
+
+/* Compiled out: no clock reads, no stores */
+static inline Self_span_t self_span_begin(void)
+{
+	return 0;
+}
+
+static inline void self_span_end(int stage, Self_span_t start)
+{
+}
+
+#endif
+
+void selfstat_report(void);
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cpumask.h"
+#include "stats.h"
+
+/*
+ * DDSketch style quantile sketch: bucket i > 0 holds the values in
+ * (gamma^(i-2), gamma^(i-1)], bucket 0 holds zero.  The inputs are small
+ * integers, so the value -> bucket mapping is a lookup table built once
+ * instead of a log() per sample.
+ */
+static int stats_build_buckets(Stats_t *stats)
+{
+	const double gamma = (1 + STATS_SKETCH_ACCURACY) / (1 - STATS_SKETCH_ACCURACY);
+	double bound = 1.0;
+	unsigned int bucket = 1;
+	int v;
+
+	stats->bucket_of[0] = 0;
+	stats->bucket_value[0] = 0;
+	stats->bucket_value[1] = 1;
+	for (v = 1; v <= STATS_MAX_VALUE; v++) {
+		while (bound < v) {
+			bound *= gamma;
+			if (++bucket >= STATS_NR_BUCKETS)
+				return -ERANGE;
+			/* midpoint in relative terms of (bound/gamma, bound] */
+			stats->bucket_value[bucket] =
+				(unsigned short)(2 * bound / (gamma + 1) + 0.5);
+		}
+		stats->bucket_of[v] = bucket;
+	}
+	return 0;
+}
+
+int init_stats(Stats_t *stats, unsigned int nr_cpus, unsigned int window)
+{
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->nr_cpus = nr_cpus;
+	stats->window = window ? window : 1;
+	/* EMA with the same center of mass as a window long average */
+	stats->alpha = 2.0 / (stats->window + 1);
+
+	if (stats_build_buckets(stats) < 0) {
+		printf("stats sketch needs more buckets\n");
+		return -ERANGE;
+	}
+
+	/* past STATS_MINMAX_BLOCKS ticks, one more block is the filling one */
+	stats->block_ticks = (stats->window + STATS_MINMAX_BLOCKS - 1) /
+				STATS_MINMAX_BLOCKS;
+	stats->nr_blocks = (stats->window + stats->block_ticks - 1) /
+				stats->block_ticks + (stats->block_ticks > 1);
+
+	stats->cpus = (Cpu_stats_t *)calloc(nr_cpus, sizeof(Cpu_stats_t));
+	stats->blocks = (Minmax_block_t *)calloc(nr_cpus * stats->nr_blocks,
+						sizeof(Minmax_block_t));
+	stats->buckets = (unsigned int *)calloc(nr_cpus * STATS_NR_BUCKETS,
+						sizeof(unsigned int));
+	if (!stats->cpus || !stats->blocks || !stats->buckets) {
+		printf("alloc mem for stats failed\n");
+		return -ENOMEM;
+	}
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		Cpu_stats_t *c = &stats->cpus[cpu];
+
+		c->blocks = &stats->blocks[cpu * stats->nr_blocks];
+		c->sketch = &stats->buckets[cpu * STATS_NR_BUCKETS];
+		c->ema = -1;
+	}
+	return 0;
+}
+
+/*
+ * Fold @value into the block of @tick.  A slot still holding an older
+ * block, from a lap ago or from before the cpu went offline, restarts.
+ */
+static void block_push(const Stats_t *stats, Minmax_block_t *blocks,
+			unsigned int tick, unsigned int value)
+{
+	unsigned int seq = tick / stats->block_ticks;
+	Minmax_block_t *b = &blocks[seq % stats->nr_blocks];
+
+	if (b->seq != seq + 1) {
+		b->seq = seq + 1;
+		b->min = b->max = value;
+	} else if (value < b->min) {
+		b->min = value;
+	} else if (value > b->max) {
+		b->max = value;
+	}
+}
+
+/* Min (or max, with @is_max) over the blocks still in the window */
+static unsigned int block_fold(const Stats_t *stats, int cpu, int is_max)
+{
+	const Minmax_block_t *blocks = stats->cpus[cpu].blocks;
+	unsigned int last, i, found = 0;
+	unsigned int value = 0;
+
+	if (!stats->tick)
+		return 0;
+	last = (stats->tick - 1) / stats->block_ticks + 1;
+	for (i = 0; i < stats->nr_blocks; i++) {
+		const Minmax_block_t *b = &blocks[i];
+		unsigned int v = is_max ? b->max : b->min;
+
+		if (!b->seq || last - b->seq >= stats->nr_blocks)
+			continue;
+		if (!found++ || (is_max ? v > value : v < value))
+			value = v;
+	}
+	return value;
+}
+
+void stats_update(Stats_t *stats, const unsigned int *values,
+			const cpumask_t *mask)
+{
+	unsigned int tick = stats->tick++;
+	int cpu;
+
+	for_each_cpu_mask(cpu, *mask) {
+		Cpu_stats_t *c;
+		unsigned int value;
+
+		if (cpu >= stats->nr_cpus)
+			break;
+		c = &stats->cpus[cpu];
+		value = values[cpu] > STATS_MAX_VALUE ? STATS_MAX_VALUE : values[cpu];
+
+		if (c->ema < 0)
+			c->ema = value;
+		else
+			c->ema += stats->alpha * (value - c->ema);
+		block_push(stats, c->blocks, tick, value);
+		c->sketch[stats->bucket_of[value]]++;
+		c->nr_samples++;
+	}
+}
+
+unsigned int stats_min(const Stats_t *stats, int cpu)
+{
+	return block_fold(stats, cpu, 0);
+}
+
+unsigned int stats_max(const Stats_t *stats, int cpu)
+{
+	return block_fold(stats, cpu, 1);
+}
+
+unsigned int stats_quantile(const Stats_t *stats, int cpu, double q)
+{
+	const Cpu_stats_t *c = &stats->cpus[cpu];
+	unsigned long long rank, seen = 0;
+	int i;
+
+	if (!c->nr_samples)
+		return 0;
+	rank = (unsigned long long)(q * (c->nr_samples - 1));
+	for (i = 0; i < STATS_NR_BUCKETS; i++) {
+		seen += c->sketch[i];
+		if (seen > rank)
+			return stats->bucket_value[i];
+	}
+	return STATS_MAX_VALUE;
+}
+
+/* Start a new summary period, EMA and min/max windows carry on */
+void stats_reset_sketch(Stats_t *stats)
+{
+	int cpu;
+
+	memset(stats->buckets, 0,
+		stats->nr_cpus * STATS_NR_BUCKETS * sizeof(unsigned int));
+	for (cpu = 0; cpu < stats->nr_cpus; cpu++)
+		stats->cpus[cpu].nr_samples = 0;
+}
+
+void destroy_stats(Stats_t *stats)
+{
+	free(stats->cpus);
+	free(stats->blocks);
+	free(stats->buckets);
+	memset(stats, 0, sizeof(*stats));
+}
@@ -0,0 +1,52 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "cpumask.h"
+
+#define STATS_MAX_VALUE		1000	//utilization in 0.1% units
+#define STATS_SKETCH_ACCURACY	0.01	//relative error of the quantile sketch
+#define STATS_NR_BUCKETS	352	//enough buckets for 1..STATS_MAX_VALUE
+#define STATS_MINMAX_BLOCKS	64	//blocks a min/max window is kept in
+
+/*
+ * Min and max of one block of ticks.  A window of up to
+ * STATS_MINMAX_BLOCKS ticks keeps one block per tick and is exact; a
+ * longer one is rounded up to whole blocks, so the memory per cpu stays
+ * at most STATS_MINMAX_BLOCKS + 1 blocks whatever the window.
+ */
+typedef struct minmax_block {
+	unsigned int	seq;		//block number + 1, 0 before the first sample
+	unsigned short	min, max;
+}Minmax_block_t;
+
+typedef struct cpu_stats {
+	double		ema;		//exponential moving average
+	unsigned int	nr_samples;	//samples in the sketch
+	Minmax_block_t	*blocks;	//ring of Stats_t.nr_blocks
+	unsigned int	*sketch;	//STATS_NR_BUCKETS log spaced counters
+}Cpu_stats_t;
+
+typedef struct stats {
+	unsigned int	nr_cpus;
+	unsigned int	window;		//ticks covered by min/max
+	unsigned int	block_ticks;	//ticks per min/max block
+	unsigned int	nr_blocks;	//ring length, the filling block included
+	double		alpha;		//EMA smoothing factor
+	unsigned int	tick;
+	Cpu_stats_t	*cpus;
+	Minmax_block_t	*blocks;	//backing store of all block rings
+	unsigned int	*buckets;	//backing store of all sketches
+	unsigned short	bucket_of[STATS_MAX_VALUE + 1];
+	unsigned short	bucket_value[STATS_NR_BUCKETS];
+}Stats_t;
+
+int init_stats(Stats_t *stats, unsigned int nr_cpus, unsigned int window);
+void stats_update(Stats_t *stats, const unsigned int *values,
+			const cpumask_t *mask);
+unsigned int stats_min(const Stats_t *stats, int cpu);
+unsigned int stats_max(const Stats_t *stats, int cpu);
+unsigned int stats_quantile(const Stats_t *stats, int cpu, double q);
+void stats_reset_sketch(Stats_t *stats);
+void destroy_stats(Stats_t *stats);
+
+#endif
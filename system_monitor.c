@@ -3,6 +3,7 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <strings.h>
 #include <string.h>
@@ -12,31 +13,256 @@
 #include <regex.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
 
 #include "cpumask.h"
 #include "system_monitor.h"
+#include "topology.h"
+#include "cpuidle.h"
+#include "perfstat.h"
+#include "schedstat.h"
+#include "isolation.h"
+#include "memstat.h"
+#include "devstat.h"
+#include "stats.h"
+#include "outbuf.h"
+#include "daemon.h"
+#include "selfstat.h"
+#include "capture.h"
+#include "arena.h"
+#include "collect.h"
 
 //#define DEBUG
 
+/* Ticks shorter than this many jiffies take cpu% from a ns/us source */
+#define HIRES_JIFFIES	5
+
+enum hires_source {
+	HIRES_OFF = 0,		//jiffies from /proc/stat
+	HIRES_SCHEDSTAT,	//rq_cpu_time from /proc/schedstat
+	HIRES_CPUIDLE,		//time in no idle state
+};
+
+/* Long options without a short form */
+enum {
+	OPT_DEV_INCLUDE = 256,
+	OPT_DEV_EXCLUDE,
+	OPT_BUSY_THRESHOLD,
+	OPT_STEAL_THRESHOLD,
+	OPT_BREAKDOWN,
+	OPT_UTIL_RATE,
+	OPT_TEMP_RATE,
+	OPT_ADAPTIVE_HOLD,
+	OPT_WINDOW,
+	OPT_CHANGES_ONLY,
+	OPT_FREQ_DEADBAND,
+	OPT_TEMP_DEADBAND,
+	OPT_KEYFRAME,
+	OPT_DAEMON,
+	OPT_SOCKET,
+	OPT_HISTORY,
+	OPT_LISTEN,
+	OPT_SELF_STATS,
+	OPT_ROOT,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_THREADS,
+	OPT_PERF,
+	OPT_SCHEDSTAT,
+	OPT_PROCSTAT,
+	OPT_NO_ISOLATION,
+	OPT_IRQ_AUDIT,
+	OPT_HOUSEKEEPING,
+	OPT_SCHED,
+	OPT_MLOCK,
+	OPT_TIMER_SLACK,
+	OPT_JITTER,
+};
+
 static struct option opts[] = {
 	{ "delay", 1, NULL, 'd' },
 	{ "count", 1, NULL, 'c' },
+	{ "group-by", 1, NULL, 'g' },
+	{ "cpuidle", no_argument, NULL, 'i' },
+	{ "memory", no_argument, NULL, 'm' },
+	{ "disk", no_argument, NULL, 'b' },
+	{ "net", no_argument, NULL, 'n' },
+	{ "dev-include", 1, NULL, OPT_DEV_INCLUDE },
+	{ "dev-exclude", 1, NULL, OPT_DEV_EXCLUDE },
+	{ "adaptive", 1, NULL, 'a' },
+	{ "busy-threshold", 1, NULL, OPT_BUSY_THRESHOLD },
+	{ "steal-threshold", 1, NULL, OPT_STEAL_THRESHOLD },
+	{ "breakdown", no_argument, NULL, OPT_BREAKDOWN },
+	{ "util-rate", 1, NULL, OPT_UTIL_RATE },
+	{ "temp-rate", 1, NULL, OPT_TEMP_RATE },
+	{ "adaptive-hold", 1, NULL, OPT_ADAPTIVE_HOLD },
+	{ "summary", 1, NULL, 's' },
+	{ "window", 1, NULL, OPT_WINDOW },
+	{ "changes-only", optional_argument, NULL, OPT_CHANGES_ONLY },
+	{ "freq-deadband", 1, NULL, OPT_FREQ_DEADBAND },
+	{ "temp-deadband", 1, NULL, OPT_TEMP_DEADBAND },
+	{ "keyframe", 1, NULL, OPT_KEYFRAME },
+	{ "daemon", no_argument, NULL, OPT_DAEMON },
+	{ "socket", 1, NULL, OPT_SOCKET },
+	{ "history", 1, NULL, OPT_HISTORY },
+	{ "listen", 1, NULL, OPT_LISTEN },
+	{ "self-stats", no_argument, NULL, OPT_SELF_STATS },
+	{ "root", 1, NULL, OPT_ROOT },
+	{ "record", 1, NULL, OPT_RECORD },
+	{ "replay", 1, NULL, OPT_REPLAY },
+	{ "threads", 1, NULL, OPT_THREADS },
+	{ "perf", no_argument, NULL, OPT_PERF },
+	{ "schedstat", no_argument, NULL, OPT_SCHEDSTAT },
+	{ "procstat", no_argument, NULL, OPT_PROCSTAT },
+	{ "no-isolation", no_argument, NULL, OPT_NO_ISOLATION },
+	{ "irq-audit", no_argument, NULL, OPT_IRQ_AUDIT },
+	{ "housekeeping", 1, NULL, OPT_HOUSEKEEPING },
+	{ "sched", 1, NULL, OPT_SCHED },
+	{ "mlock", no_argument, NULL, OPT_MLOCK },
+	{ "timer-slack", 1, NULL, OPT_TIMER_SLACK },
+	{ "jitter", no_argument, NULL, OPT_JITTER },
 	{ "help", no_argument, NULL, 'h' },
 	{ NULL, 0, NULL, 0 }
 };
 
 static int interval = 500;	//default 500 milliseconds
 static int count = 0;		//no limit
+static int fast_interval = 0;	//adaptive mode period on anomalies, 0 is off
+static int busy_threshold = 90;	//any cpu above this % is an anomaly
+static int steal_threshold = 10;	//steal % flagging a cpu, 0 disables
+static int show_breakdown = 0;	//usr/sys/irq/softirq/steal/guest/iowait columns
+static int util_rate = 100;	//cpu% change per second that is an anomaly
+static int temp_rate = 5;	//degree C rise per second that is an anomaly
+static int adaptive_hold = 2000;	//ms to stay fast after the last anomaly
+static int summary_ticks = -1;	//summary every N ticks, 0 only at exit, -1 off
+static int stats_window = 0;	//ticks covered by windowed min/max, see STATS_MINMAX_BLOCKS
+static int changes_only = 0;	//only print cpus that moved past the deadband
+static int util_deadband = 20;	//0.1% units
+static int freq_deadband = 50;	//MHz
+static int temp_deadband = 2000;	//millidegree C
+static int keyframe_ticks = 60;	//print every cpu every N ticks
+static int daemon_mode = 0;	//serve ticks over a unix socket
+static const char *socket_path = DAEMON_SOCKET_PATH;
+static int daemon_history = DAEMON_HISTORY;	//ticks kept for "last N"
+static const char *listen_addr = NULL;	//[ADDR:]PORT of the metrics endpoint
+static int self_stats = 0;	//print per stage timings at exit
+const char *sysroot = "";	//--root, read a fixture tree instead of /proc, /sys
+static const char *capture_dir = NULL;	//--record/--replay directory
+static int capture_mode = CAPTURE_OFF;
+static int collect_threads = 1;	//threads reading the per cpu files
+static int hires_source = HIRES_OFF;	//cpu% source below HIRES_JIFFIES
+static int use_isolation = 1;	//spare isolated/nohz_full cpus
+static int irq_audit = 0;	//report IPIs the audited cpus took at exit
+static const char *housekeeping_list = NULL;	//--housekeeping, cpus we run on
+static cpumask_t housekeeping_cpus;
+static const char *sched_policy = NULL;	//idle or fifo[:PRIO]
+static int lock_memory = 0;	//mlockall and prefault
+static long timer_slack = -1;	//ns, -1 leaves the default
+static int show_jitter = 0;	//print tick interval stats at exit
+static Jitter_t jitter;
+static volatile sig_atomic_t stop_requested = 0;
+static int group_by = TOPO_CPU;	//topology level to print
+static int show_cpuidle = 0;	//sample C-state residency
+static int show_perf = 0;	//sample per cpu perf counter groups
+static int show_sched = 0;	//sample run queue delay from /proc/schedstat
+static int show_procstat = 0;	//print the system wide /proc/stat counters
+static int show_memory = 0;	//sample meminfo, vmstat and PSI
+static int show_disk = 0;	//sample /proc/diskstats
+static int show_net = 0;	//sample /proc/net/dev
 cpumask_t cpu_online_map;	//cpu status, online or offline
+static cpumask_t steal_map;	//cpus past steal_threshold in the last tick
 static Systeminfo_t systeminfo;
+static Topology_t topology;
+static Cpuidle_t cpuidle;
+static Perfstat_t perfstat;
+static Schedstat_t schedstat;
+static Isolation_t isolation;
+static Irq_audit_t irqaudit;
+static cpumask_t audit_cpus;	//quiet cpus, or all online without any
+static Memstat_t memstat;
+static Dev_table_t diskstat, netstat;
+static Dev_filter_t dev_filter;
+static Stats_t stats;
+static Outbuf_t tick_out;	//rendered output of the current tick
+static Capture_t capture;	//source of the per tick stat/cpufreq/thermal reads
+static Collect_t collect;	//shards of the cpufreq stage
+
+/* Values of each cpu row as last printed in --changes-only mode */
+typedef struct emitted_row {
+	unsigned int	util;
+	unsigned int	freq;
+	unsigned int	temp;
+}Emitted_row_t;
+static Emitted_row_t *emitted;
+static Arena_t arena;		//per cpu state, see init_systeminfo_struct()
 
 static void usage(void)
 {
 	printf("cpu_monitor 11/16/2021. (c) 2021 huafenghuang/(c).\n\n"
-		"cpu_monitor [-dmillisecond] [-cCOUNT]\n"
+		"cpu_monitor [-dmillisecond] [-cCOUNT] [-gLEVEL] [-i] [-m] [-b] [-n] [-aFAST_MS] [-sTICKS]\n"
+		"cpu_monitor --daemon [--socket PATH] [--history TICKS] [options]\n"
+		"cpu_monitor client [--socket PATH] [snapshot|last N|summary]\n"
 		"cpu_monitor -h\n"
 		"-d|--delay                      Set the monitoring period\n"
 		"-c|--count                      Set the monitoring time\n"
+		"-g|--group-by                   Roll cpus up by cpu|core|llc|package|node\n"
+		"-i|--cpuidle                    Show C-state residency and wake latency\n"
+		"--perf                          Show IPC, cache MPKI and context switches from\n"
+		"                                perf counters (software events without a PMU)\n"
+		"--schedstat                     Show run queue wait per timeslice and pressure\n"
+		"                                next to CPU%% (needs CONFIG_SCHEDSTATS)\n"
+		"--procstat                      Show context switch, interrupt, softirq and fork\n"
+		"                                rates and runnable/blocked tasks from /proc/stat\n"
+		"--breakdown                     Split CPU%% into usr/sys/irq/softirq/steal/guest/\n"
+		"                                iowait columns\n"
+		"--steal-threshold PCT           Flag cpus with PCT%% steal in a tick (default 10,\n"
+		"                                0: off), adaptive mode samples fast on it\n"
+		"-m|--memory                     Show memory, swap and pressure stall info\n"
+		"-b|--disk                       Show block device throughput\n"
+		"-n|--net                        Show network interface throughput\n"
+		"--dev-include REGEX             Only show disks/interfaces matching REGEX\n"
+		"--dev-exclude REGEX             Hide disks/interfaces matching REGEX\n"
+		"-a|--adaptive                   Sample every FAST_MS on anomalies, -d otherwise\n"
+		"--busy-threshold PCT            Adaptive: any cpu above PCT%% (default 90)\n"
+		"--util-rate PCT                 Adaptive: cpu%% changing PCT per second (default 100)\n"
+		"--temp-rate DEG                 Adaptive: temp rising DEG C per second (default 5)\n"
+		"--adaptive-hold MS              Adaptive: stay fast MS after an anomaly (default 2000)\n"
+		"-s|--summary                    Only print per cpu ema/min/max/p50/p90/p99\n"
+		"                                every TICKS ticks (0: at exit)\n"
+		"--window TICKS                  Min/max window (default summary period or 60);\n"
+		"                                past 64 ticks it is kept in 64 blocks, rounded\n"
+		"                                up to whole blocks, 520 bytes per cpu at most\n"
+		"--changes-only[=PCT]            Only print cpus whose CPU%% moved more than PCT\n"
+		"                                (default 2), or whose freq/temp moved\n"
+		"--freq-deadband MHZ             Changes-only: cpufreq deadband (default 50)\n"
+		"--temp-deadband MDEG            Changes-only: temp deadband (default 2000)\n"
+		"--keyframe TICKS                Changes-only: print all cpus every TICKS (default 60)\n"
+		"--daemon                        Sample in the background and answer queries\n"
+		"                                on a unix socket instead of printing\n"
+		"--socket PATH                   Daemon socket (default " DAEMON_SOCKET_PATH ")\n"
+		"--history TICKS                 Daemon: ticks kept for 'last N' (default 60)\n"
+		"--listen [ADDR:]PORT            Serve Prometheus metrics over HTTP at /metrics\n"
+		"                                (ADDR defaults to " DAEMON_LISTEN_ADDR ")\n"
+		"--root DIR                      Read proc/ and sys/ under DIR (fixture trees)\n"
+		"--record DIR                    Append the raw stat/cpufreq/thermal reads of\n"
+		"                                every tick to DIR/" CAPTURE_FILE "\n"
+		"--replay DIR                    Run a recorded capture through the parsers\n"
+		"                                and display without sleeping\n"
+		"--threads N                     Read the per cpu files on N threads (default 1,\n"
+		"                                live reads only)\n"
+		"--no-isolation                  Sample isolated/nohz_full cpus like the others\n"
+		"                                (cpuinfo_cur_freq, perf, any cpu for threads)\n"
+		"--irq-audit                     Print the IPIs isolated cpus (all cpus without\n"
+		"                                any) took during the run, at exit\n"
+		"--housekeeping CPULIST          Run the monitor and its threads on CPULIST only\n"
+		"                                (kernel cpulist syntax: 0-3,8, 0-N:1/2, all)\n"
+		"--sched idle|fifo[:PRIO]        SCHED_IDLE to yield to the workload, SCHED_FIFO\n"
+		"                                to tick on time\n"
+		"--mlock                         Lock and prefault memory, no faults mid-tick\n"
+		"--timer-slack NS                Timer slack of the monitor threads\n"
+		"--jitter                        Print tick to tick interval stats at exit\n"
+		"--self-stats                    Print per stage timings and overhead at exit\n"
+		"                                (needs make SELF_STATS=1)\n"
 		"-h|--help                       Show usage information\n"
 	);
 }
@@ -44,7 +270,7 @@ static void usage(void)
 static void parse_command_line(int argc, char **argv)
 {
 	int c;
-	while ((c = getopt_long(argc, argv, "d:c:h", opts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "d:c:g:imbna:s:h", opts, NULL)) != -1) {
 		switch(c) {
 			case 'd':
 				if (!optarg) {
@@ -64,6 +290,157 @@ static void parse_command_line(int argc, char **argv)
 				if (count < 0)
 					count = 0;	// use default value
 				break;
+			case 'g':
+				group_by = topology_level_parse(optarg);
+				if (group_by < 0) {
+					printf("Unknown topology level:%s\n", optarg);
+					usage();
+					exit(1);
+				}
+				break;
+			case 'i':
+				show_cpuidle = 1;
+				break;
+			case OPT_PERF:
+				show_perf = 1;
+				break;
+			case OPT_SCHEDSTAT:
+				show_sched = 1;
+				break;
+			case OPT_PROCSTAT:
+				show_procstat = 1;
+				break;
+			case OPT_NO_ISOLATION:
+				use_isolation = 0;
+				break;
+			case OPT_IRQ_AUDIT:
+				irq_audit = 1;
+				break;
+			case OPT_HOUSEKEEPING:
+				housekeeping_list = optarg;
+				if (cpulist_parse(optarg, strlen(optarg),
+						housekeeping_cpus) < 0 ||
+				    cpus_empty(housekeeping_cpus)) {
+					printf("Invalid cpu list:%s\n", optarg);
+					exit(1);
+				}
+				break;
+			case OPT_SCHED:
+				sched_policy = optarg;
+				break;
+			case OPT_MLOCK:
+				lock_memory = 1;
+				break;
+			case OPT_TIMER_SLACK:
+				timer_slack = atol(optarg);
+				if (timer_slack < 0)
+					timer_slack = -1;	// use default value
+				break;
+			case OPT_JITTER:
+				show_jitter = 1;
+				break;
+			case 'm':
+				show_memory = 1;
+				break;
+			case 'b':
+				show_disk = 1;
+				break;
+			case 'n':
+				show_net = 1;
+				break;
+			case 'a':
+				fast_interval = atoi(optarg);
+				if (fast_interval <= 0)
+					fast_interval = 50;	// use default value
+				break;
+			case OPT_BUSY_THRESHOLD:
+				busy_threshold = atoi(optarg);
+				break;
+			case OPT_STEAL_THRESHOLD:
+				steal_threshold = atoi(optarg);
+				if (steal_threshold < 0)
+					steal_threshold = 0;
+				break;
+			case OPT_BREAKDOWN:
+				show_breakdown = 1;
+				break;
+			case OPT_UTIL_RATE:
+				util_rate = atoi(optarg);
+				break;
+			case OPT_TEMP_RATE:
+				temp_rate = atoi(optarg);
+				break;
+			case OPT_ADAPTIVE_HOLD:
+				adaptive_hold = atoi(optarg);
+				if (adaptive_hold < 0)
+					adaptive_hold = 0;
+				break;
+			case 's':
+				summary_ticks = atoi(optarg);
+				if (summary_ticks < 0)
+					summary_ticks = 0;	// use default value
+				break;
+			case OPT_WINDOW:
+				stats_window = atoi(optarg);
+				if (stats_window < 0)
+					stats_window = 0;	// use default value
+				break;
+			case OPT_CHANGES_ONLY:
+				changes_only = 1;
+				if (optarg)
+					util_deadband = atof(optarg) * 10;
+				break;
+			case OPT_FREQ_DEADBAND:
+				freq_deadband = atoi(optarg);
+				break;
+			case OPT_TEMP_DEADBAND:
+				temp_deadband = atoi(optarg);
+				break;
+			case OPT_KEYFRAME:
+				keyframe_ticks = atoi(optarg);
+				if (keyframe_ticks <= 0)
+					keyframe_ticks = 60;	// use default value
+				break;
+			case OPT_DAEMON:
+				daemon_mode = 1;
+				break;
+			case OPT_SOCKET:
+				socket_path = optarg;
+				break;
+			case OPT_HISTORY:
+				daemon_history = atoi(optarg);
+				if (daemon_history <= 0)
+					daemon_history = DAEMON_HISTORY;	// use default value
+				break;
+			case OPT_RECORD:
+			case OPT_REPLAY:
+				capture_dir = optarg;
+				capture_mode = c == OPT_RECORD ?
+					CAPTURE_RECORD : CAPTURE_REPLAY;
+				break;
+			case OPT_ROOT:
+				sysroot = optarg;
+				break;
+			case OPT_THREADS:
+				collect_threads = atoi(optarg);
+				if (collect_threads <= 0 ||
+				    collect_threads > COLLECT_MAX_THREADS)
+					collect_threads = 1;	// use default value
+				break;
+			case OPT_SELF_STATS:
+				self_stats = 1;
+				break;
+			case OPT_LISTEN:
+				listen_addr = optarg;
+				break;
+			case OPT_DEV_INCLUDE:
+			case OPT_DEV_EXCLUDE:
+				if (dev_filter_set(&dev_filter, optarg,
+						c == OPT_DEV_EXCLUDE) < 0) {
+					printf("Invalid device regex:%s\n", optarg);
+					exit(1);
+				}
+				break;
 			case 'h':
 			default:
 				usage();
@@ -92,24 +469,138 @@ static void get_temp(char *line, void *data)
 	*temp = strtoul(line, NULL, 10);
 }
 
-int process_one_line(char *path, void (*cb)(char *line, void *data), void *data)
+int root_path(char *buf, size_t size, const char *fmt, ...)
 {
-	FILE *file;
-	char *line = NULL;
-	size_t size = 0;
-	int ret = -1;
+	va_list ap;
+	int len, ret;
+
+	len = snprintf(buf, size, "%s", sysroot);
+	if (len >= size)
+		return -ENAMETOOLONG;
+	va_start(ap, fmt);
+	ret = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+	if (ret < 0 || ret >= size - len)
+		return -ENAMETOOLONG;
+	return len + ret;
+}
 
-	file = fopen(path, "r");
-	if (!file)
-		return ret;
+/* process_one_line() for the per tick files, they may be recorded or replayed */
+static int sample_one_line(const char *path, void (*cb)(char *line, void *data),
+				void *data)
+{
+	char *buf;
 
-	if (getline(&line, &size, file) > 0) {
-		cb(line, data);
-		ret = 0;
+	/* collection threads may be running, the capture buffer is shared */
+	if (capture.mode == CAPTURE_OFF) {
+		char full[PATH_MAX];
+
+		root_path(full, PATH_MAX, "%s", path);
+		return process_one_line(full, cb, data);
+	}
+	if (capture_read(&capture, path, &buf) <= 0)
+		return -1;
+	cb(buf, data);
+	return 0;
+}
+
+/*
+ * The first line of @path to @cb.  Per tick files fit the stack buffer;
+ * a longer one, like the cpulist of a node or a cache on a big host, is
+ * read whole into a heap buffer instead of being cut short.
+ */
+int process_one_line(const char *path, void (*cb)(char *line, void *data), void *data)
+{
+	char stack_buf[LINE_BUF_SIZE];
+	char *line = stack_buf;
+	size_t size = sizeof(stack_buf);
+	ssize_t len;
+	char *end;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, line, size - 1);
+	if (len == (ssize_t)size - 1) {
+		size *= 2;
+		line = malloc(size);
+		len = line ? pread_whole_file(fd, &line, &size) : -ENOMEM;
+	}
+	close(fd);
+	if (len <= 0)
+		goto out;
+
+	line[len] = '\0';
+	end = strchr(line, '\n');
+	if (end)
+		end[1] = '\0';
+	cb(line, data);
+out:
+	if (line != stack_buf)
+		free(line);
+	return len <= 0 ? -1 : 0;
+}
+
+/*
+ * Re-read a small sysfs/procfs file through a descriptor kept open across
+ * ticks, which saves the open/close pair on every sample.
+ */
+ssize_t pread_one_line(int fd, char *buf, size_t size)
+{
+	ssize_t nread;
+
+	nread = pread(fd, buf, size - 1, 0);
+	if (nread < 0)
+		return nread;
+	buf[nread] = '\0';
+	return nread;
+}
+
+/*
+ * Read a whole proc file through a persistent descriptor into *buf, which
+ * is grown (never shrunk) when the file does not fit.
+ */
+ssize_t pread_whole_file(int fd, char **buf, size_t *size)
+{
+	size_t len = 0;
+	ssize_t nread;
+
+	for (;;) {
+		nread = pread(fd, *buf + len, *size - 1 - len, len);
+		if (nread < 0)
+			return -errno;
+		if (nread == 0)
+			break;
+		len += nread;
+		if (len == *size - 1) {
+			char *new_buf = realloc(*buf, *size * 2);
+
+			if (!new_buf)
+				return -ENOMEM;
+			*buf = new_buf;
+			*size *= 2;
+		}
+	}
+	(*buf)[len] = '\0';
+	return len;
+}
+
+/*
+ * Per cpu descriptors kept open across ticks add up on large machines, so
+ * lift the soft fd limit to the hard one up front; whatever still does
+ * not fit falls back to reopening per read.
+ */
+void raise_nofile_limit(void)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		return;
+	if (rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
 	}
-	free(line);
-	fclose(file);
-	return ret;
 }
 
 static char *fmt_100percent_8(char pbuf[8], unsigned value, unsigned total)
@@ -134,50 +625,63 @@ static char *fmt_100percent_8(char pbuf[8], unsigned value, unsigned total)
 	return pbuf;
 }
 
-static void parse_online_cpufreq_info(char *path)
+static void parse_online_cpufreq_info(char *path, int cpu_num)
 {
 	int offline_status = 0;
-	int cpu_num = -1;
 	char new_path[PATH_MAX];
 	unsigned int cpufreq = 0;
 	int ret;
 
 	/* skip offline cpus */
 	snprintf(new_path, ADJ_SIZE(PATH_MAX, path, "/online"), "%s/online", path);
-	ret = process_one_line(new_path, get_offline_status, &offline_status);
-	if ( ret < 0 || offline_status)
+	ret = sample_one_line(new_path, get_offline_status, &offline_status);
+	if ( ret < 0 || offline_status) {
+		systeminfo.cpu[cpu_num].online = 0;
 		return;
+	}
+	systeminfo.cpu[cpu_num].online = 1;
 
-	cpu_num = strtoul(&path[27], NULL, 10);
-
-
-	cpu_set(cpu_num, cpu_online_map);
-
-	/* get online cpufreq */
+	/*
+	 * get online cpufreq, cpuinfo_cur_freq asks the cpu itself through
+	 * an IPI on x86, scaling_cur_freq is served from what the kernel has
+	 */
 	snprintf(new_path, ADJ_SIZE(PATH_MAX, path, "/cpufreq/cpuinfo_cur_freq"),
-			"%s/cpufreq/cpuinfo_cur_freq", path);
-	ret = process_one_line(new_path, get_cpufreq, &cpufreq);
+			"%s/cpufreq/%s", path, cpu_isset(cpu_num, isolation.quiet) ?
+			"scaling_cur_freq" : "cpuinfo_cur_freq");
+	ret = sample_one_line(new_path, get_cpufreq, &cpufreq);
+	/* isolated cpus were recorded from scaling_cur_freq */
+	if (ret < 0 && capture.mode == CAPTURE_REPLAY) {
+		snprintf(new_path, ADJ_SIZE(PATH_MAX, path, "/cpufreq/scaling_cur_freq"),
+				"%s/cpufreq/scaling_cur_freq", path);
+		ret = sample_one_line(new_path, get_cpufreq, &cpufreq);
+	}
 	if (ret < 0) {
 		cpufreq = 0;
 #ifdef DEBUG
 		printf("Need to support cpufreq driver\n");
 #endif
 	}
-	systeminfo.cpufreq[cpu_num] = cpufreq;
+	systeminfo.cpu[cpu_num].cpufreq = cpufreq;
 #ifdef DEBUG
 	printf("cpu num:%d, cpufreq:%u\n", cpu_num, cpufreq);
 #endif
 }
 
+static inline char *next_line(char *line)
+{
+	line = strchr(line, '\n');
+	return line ? line + 1 : NULL;
+}
+
 static int read_cpu_jiffy(char *line, Jiffy_count_t *p_jif)
 {
-	static const char fmt[] = "cp%*s %llu %llu %llu %llu %llu %llu %llu %llu";
+	static const char fmt[] = "cp%*s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu";
 	int ret;
 
 	ret = sscanf(line, fmt,
 		&p_jif->usr, &p_jif->nic, &p_jif->sys, &p_jif->idle,
 		&p_jif->iowait, &p_jif->irq, &p_jif->softirq,
-		&p_jif->steal);
+		&p_jif->steal, &p_jif->guest, &p_jif->guest_nice);
 #ifdef DEBUG
 	printf("usr:%llu nic:%llu sys:%llu idle:%llu iowait:%llu irq:%llu \
 		sortirq:%llu steal:%llu\n", p_jif->usr, p_jif->nic, p_jif->sys,
@@ -193,42 +697,190 @@ static int read_cpu_jiffy(char *line, Jiffy_count_t *p_jif)
 	return ret;
 }
 
-static int do_stat()
+static const char * const procstat_keys[NR_PROCSTAT_SLOTS] = {
+	[PROCSTAT_CTXT]		= "ctxt",
+	[PROCSTAT_INTR]		= "intr",
+	[PROCSTAT_SOFTIRQ]	= "softirq",
+	[PROCSTAT_PROCESSES]	= "processes",
+	[PROCSTAT_RUNNING]	= "procs_running",
+	[PROCSTAT_BLOCKED]	= "procs_blocked",
+};
+
+static const char * const softirq_names[NR_SOFTIRQ_SLOTS] = {
+	[SOFTIRQ_HI]		= "hi",
+	[SOFTIRQ_TIMER]		= "timer",
+	[SOFTIRQ_NET_TX]	= "net_tx",
+	[SOFTIRQ_NET_RX]	= "net_rx",
+	[SOFTIRQ_BLOCK]		= "block",
+	[SOFTIRQ_IRQ_POLL]	= "irq_poll",
+	[SOFTIRQ_TASKLET]	= "tasklet",
+	[SOFTIRQ_SCHED]		= "sched",
+	[SOFTIRQ_HRTIMER]	= "hrtimer",
+	[SOFTIRQ_RCU]		= "rcu",
+};
+
+/*
+ * One of the /proc/stat lines after the cpu lines.  Only the leading
+ * total of "intr" is taken, the per irq counts after it are skipped.
+ */
+static void read_stat_counter(char *line, Procstat_t *stat)
 {
-	FILE *file;
-	char *line = NULL;
-	ssize_t nread, len;
-	int ret = 0;
-	int cpu_id = 0;
-	Jiffy_count_t *p_cur_jiffy = systeminfo.cur_jiffy;
-	Jiffy_count_t *p_prev_jiffy = systeminfo.prev_jiffy;
-	char **p_rate = systeminfo.cpu_rate;
+	char *p;
+	int i, len;
 
+	for (i = 0; i < NR_PROCSTAT_SLOTS; i++) {
+		len = strlen(procstat_keys[i]);
+		if (!strncmp(line, procstat_keys[i], len) && line[len] == ' ')
+			break;
+	}
+	if (i == NR_PROCSTAT_SLOTS)
+		return;
 
-	if (!p_cur_jiffy || !p_prev_jiffy || !p_rate) {
-		printf("The point of systeminfo.cur_jiffy is error\n");
-		return -ENOMEM;
+	stat->cur[i] = strtoull(line + len, &p, 10);
+	if (i != PROCSTAT_SOFTIRQ)
+		return;
+	for (i = 0; i < NR_SOFTIRQ_SLOTS && *p == ' '; i++)
+		stat->softirq[i] = strtoull(p, &p, 10);
+}
+
+/* Turn the counters of the last two reads into per second rates */
+static void procstat_rates(Procstat_t *stat)
+{
+	unsigned long long now;
+	int i;
+
+	/* a replayed tick is timed by its capture, not by how fast we run */
+	now = capture.mode == CAPTURE_REPLAY ? capture.tick_ns : monotonic_ns();
+	stat->elapsed_ns = stat->last_ns ? now - stat->last_ns : 0;
+	stat->last_ns = now;
+
+	for (i = 0; i < NR_PROCSTAT_SLOTS; i++) {
+		if (i == PROCSTAT_RUNNING || i == PROCSTAT_BLOCKED)
+			stat->rate[i] = stat->cur[i];
+		else if (!stat->elapsed_ns || stat->cur[i] < stat->prev[i])
+			stat->rate[i] = 0;
+		else
+			stat->rate[i] = (stat->cur[i] - stat->prev[i]) *
+					NSEC_PER_SEC / stat->elapsed_ns;
+	}
+	for (i = 0; i < NR_SOFTIRQ_SLOTS; i++) {
+		if (!stat->elapsed_ns || stat->softirq[i] < stat->prev_softirq[i])
+			stat->softirq_rate[i] = 0;
+		else
+			stat->softirq_rate[i] = (stat->softirq[i] -
+				stat->prev_softirq[i]) * NSEC_PER_SEC / stat->elapsed_ns;
 	}
+}
+
+/* iowait is known to go backwards, never let one field wrap */
+static inline unsigned long long jiffy_delta(unsigned long long cur,
+					unsigned long long prev)
+{
+	return cur > prev ? cur - prev : 0;
+}
+
+/*
+ * Split the tick of one cpu by where the time went.  The deltas are
+ * taken into one array first so the scaling is a single loop.
+ */
+static void cpu_split(Cpu_state_t *state, unsigned total_diff)
+{
+	const Jiffy_count_t *cur = &state->cur_jiffy, *prev = &state->prev_jiffy;
+	unsigned long long d[NR_SPLIT_SLOTS];
+	int i;
 
-	memcpy((void *)p_prev_jiffy, (void *)p_cur_jiffy,
-			(systeminfo.nr_cpus + 1) * sizeof(Jiffy_count_t));
+	d[SPLIT_USR] = jiffy_delta(cur->usr + cur->nic, prev->usr + prev->nic);
+	d[SPLIT_SYS] = jiffy_delta(cur->sys, prev->sys);
+	d[SPLIT_IRQ] = jiffy_delta(cur->irq, prev->irq);
+	d[SPLIT_SOFTIRQ] = jiffy_delta(cur->softirq, prev->softirq);
+	d[SPLIT_STEAL] = jiffy_delta(cur->steal, prev->steal);
+	d[SPLIT_GUEST] = jiffy_delta(cur->guest + cur->guest_nice,
+				prev->guest + prev->guest_nice);
+	d[SPLIT_IOWAIT] = jiffy_delta(cur->iowait, prev->iowait);
+	/* the kernel counts guest time in usr/nic as well */
+	d[SPLIT_USR] = d[SPLIT_USR] > d[SPLIT_GUEST] ?
+			d[SPLIT_USR] - d[SPLIT_GUEST] : 0;
+
+	for (i = 0; i < NR_SPLIT_SLOTS; i++)
+		state->split[i] = d[i] >= total_diff ? 1000 :
+				1000 * d[i] / total_diff;
+}
+
+/*
+ * The busy share of @cpu from the high resolution source, if one is in
+ * use, this tick was under HIRES_JIFFIES and the source has a delta for
+ * this cpu.  Both sources only move on a state change, so a value more
+ * than a jiffy away from the jiffy counts is stale and not taken.
+ */
+static int hires_util(unsigned int cpu, unsigned busy_diff, unsigned total_diff,
+		      unsigned int *util)
+{
+	unsigned int lo, hi;
+	int busy = -1;
+
+	if (total_diff >= HIRES_JIFFIES)
+		return -1;
+	if (hires_source == HIRES_SCHEDSTAT && cpu < schedstat.nr_cpus)
+		busy = schedstat.cpus[cpu].busy;
+	else if (hires_source == HIRES_CPUIDLE && cpu < cpuidle.nr_cpus)
+		busy = cpuidle.cpus[cpu].busy;
+	if (busy < 0)
+		return -1;
+
+	lo = busy_diff ? 1000 * (busy_diff - 1) / total_diff : 0;
+	hi = busy_diff + 1 >= total_diff ? 1000 : 1000 * (busy_diff + 1) / total_diff;
+	if ((unsigned int)busy < lo || (unsigned int)busy > hi)
+		return -1;
+	*util = busy;
+	return 0;
+}
 
-	/* clear cur_jiffy buf */
-	memset(p_cur_jiffy, 0, (systeminfo.nr_cpus + 1) * sizeof(Jiffy_count_t));
+static int do_stat()
+{
+	char *buf, *line;
+	int ret = 0;
+	unsigned int cpu_id = 0;
+	Cpu_state_t *state;
+
+	if (!systeminfo.cpu) {
+		printf("The point of systeminfo.cpu is error\n");
+		return -ENOMEM;
+	}
 
-	file = fopen(STAT_PATH, "r");
-	if (!file) {
+	systeminfo.prev_jiffy = systeminfo.cur_jiffy;
+	memset(&systeminfo.cur_jiffy, 0, sizeof(Jiffy_count_t));
+	for (cpu_id = 0; cpu_id < systeminfo.nr_cpus; cpu_id++) {
+		state = &systeminfo.cpu[cpu_id];
+		state->prev_jiffy = state->cur_jiffy;
+		/* clear cur_jiffy buf */
+		memset(&state->cur_jiffy, 0, sizeof(Jiffy_count_t));
+	}
+	systeminfo.max_util = 0;
+	systeminfo.max_util_delta = 0;
+	systeminfo.max_steal = 0;
+	systeminfo.hotplug = 0;
+	cpus_clear(steal_map);
+	memcpy(systeminfo.stat.prev, systeminfo.stat.cur, sizeof(systeminfo.stat.cur));
+	memcpy(systeminfo.stat.prev_softirq, systeminfo.stat.softirq,
+		sizeof(systeminfo.stat.softirq));
+
+	if (capture_read(&capture, STAT_PATH, &buf) < 0) {
 		printf("Need to support /proc/stat\n");
 		return -EINVAL;
 	}
 
-	/* Only need CPU info */
-	while ((nread = getline(&line, &len, file)) != -1 && line[0] == 'c') {
+	/* The cpu lines, then the system wide counters, in one pass */
+	for (line = buf; line && *line; line = next_line(line)) {
 		char *p_buf;
+		unsigned int util, delta;
 
+		if (strncmp(line, "cpu", strlen("cpu"))) {
+			read_stat_counter(line, &systeminfo.stat);
+			continue;
+		}
 		if (!strncmp(line, "cpu ", strlen("cpu "))) {
 			/* First line */
-			ret = read_cpu_jiffy(line, &p_cur_jiffy[0]);
+			ret = read_cpu_jiffy(line, &systeminfo.cur_jiffy);
 			if (ret < 0) {
 				printf("read /proc/stat failed\n");
 				return -EINVAL;
@@ -245,58 +897,122 @@ static int do_stat()
 #ifdef DEBUG
 		printf("cpu_id:%u\n", cpu_id);
 #endif
+		if (cpu_id >= systeminfo.nr_cpus)
+			continue;
+		state = &systeminfo.cpu[cpu_id];
 		/* reset cpu_online_map here for not support cpufreq */
 		cpu_set(cpu_id, cpu_online_map);
 
 		/*Get all online cpu jify */
-		ret = read_cpu_jiffy(line, &p_cur_jiffy[cpu_id + 1]);
+		ret = read_cpu_jiffy(line, &state->cur_jiffy);
 		if (ret < 0) {
 			printf("read /proc/stat failed\n");
 			return -EINVAL;
 		}
 
-		/* compare p_cur_jiffy[cpu_id+1].idle with
-		 * p_prev_jiffy[cpu_id+1].idle for hotplug
-		 */
-		if (p_cur_jiffy[cpu_id + 1].idle < p_prev_jiffy[cpu_id + 1].idle) {
+		/* compare cur_jiffy.idle with prev_jiffy.idle for hotplug */
+		if (state->cur_jiffy.idle < state->prev_jiffy.idle) {
 			/* cpu hotplug happen when sample
 			 * assume the cpu in dile, so the cpu utilization is 0
 			 */
-			fmt_100percent_8(p_rate[cpu_id], 0, 1);
+			fmt_100percent_8(state->rate, 0, 1);
+			memset(state->split, 0, sizeof(state->split));
+			util = 0;
+			systeminfo.hotplug = 1;
 		} else {
 			/*
 			 * cpu% = (cur_jif.busy - prev_jif.busy) / (cur_jif.total - prev_jif.total) * 100%
 			*/
 			unsigned total_diff, busy_diff;
-			total_diff = (unsigned)(p_cur_jiffy[cpu_id + 1].total - p_prev_jiffy[cpu_id + 1].total);
-			busy_diff = (unsigned)(p_cur_jiffy[cpu_id + 1].busy - p_prev_jiffy[cpu_id + 1].busy);
+			total_diff = (unsigned)(state->cur_jiffy.total - state->prev_jiffy.total);
+			busy_diff = (unsigned)(state->cur_jiffy.busy - state->prev_jiffy.busy);
 			if (total_diff == 0)
 				total_diff = 1;
-			fmt_100percent_8(p_rate[cpu_id], busy_diff, total_diff);
+			fmt_100percent_8(state->rate, busy_diff, total_diff);
+			util = busy_diff >= total_diff ? 1000 :
+					1000 * busy_diff / total_diff;
+			if (hires_util(cpu_id, busy_diff, total_diff, &util) == 0)
+				fmt_100percent_8(state->rate, util, 1000);
+			cpu_split(state, total_diff);
 		}
+
+		/* flag a steal spike on the tick it shows up */
+		if (state->split[SPLIT_STEAL] > systeminfo.max_steal)
+			systeminfo.max_steal = state->split[SPLIT_STEAL];
+		if (steal_threshold &&
+		    state->split[SPLIT_STEAL] >= steal_threshold * 10)
+			cpu_set(cpu_id, steal_map);
+
+		delta = util > systeminfo.cpu_util[cpu_id] ?
+			util - systeminfo.cpu_util[cpu_id] :
+			systeminfo.cpu_util[cpu_id] - util;
+		systeminfo.cpu_util[cpu_id] = util;
+		if (util > systeminfo.max_util)
+			systeminfo.max_util = util;
+		if (delta > systeminfo.max_util_delta)
+			systeminfo.max_util_delta = delta;
 	}
+	procstat_rates(&systeminfo.stat);
 
-	free(line);
-	fclose(file);
 	return 0;
 }
 
-static int parse_cpu_info(void)
+/* Take every cumulative counter the rates are computed from */
+static void sample_counters(void)
 {
-	char new_path[PATH_MAX];
-	int i;
+	Self_span_t t;
+
+	/* do_stat() takes cpu% from the high resolution source */
+	if (hires_source == HIRES_SCHEDSTAT)
+		schedstat_sample(&schedstat);
+	else if (hires_source == HIRES_CPUIDLE)
+		cpuidle_sample(&cpuidle);
+	t = self_span_begin();
+	do_stat();
+	self_span_end(SELF_STAGE_STAT, t);
+	if (show_cpuidle && hires_source != HIRES_CPUIDLE)
+		cpuidle_sample(&cpuidle);
+	if (show_perf)
+		perfstat_sample(&perfstat);
+	if (show_sched && hires_source != HIRES_SCHEDSTAT)
+		schedstat_sample(&schedstat);
+	if (show_memory)
+		memstat_sample(&memstat);
+	if (show_disk)
+		dev_table_sample(&diskstat, &dev_filter);
+	if (show_net)
+		dev_table_sample(&netstat, &dev_filter);
+}
 
-	/* Must clear all mask for cpu hotplug */
-	cpus_clear(cpu_online_map);
+/* Cpufreq stage for cpus [first, last), runs on the collection threads */
+static void parse_cpufreq_shard(unsigned int first, unsigned int last,
+				void *data)
+{
+	char new_path[PATH_MAX];
+	unsigned int i;
 
-	for (i = 0; i < systeminfo.nr_cpus; i++) {
-		/* Fix me, use macro instead of str */
-		snprintf(new_path, PATH_MAX, "/sys/devices/system/cpu/cpu%d", i);
+	for (i = first; i < last; i++) {
+		snprintf(new_path, PATH_MAX, CPU_PATH "/cpu%u", i);
 #ifdef DEBUG
-		printf("path:%s, i:%d\n", new_path, i);
+		printf("path:%s, i:%u\n", new_path, i);
 #endif
-		parse_online_cpufreq_info(new_path);
+		parse_online_cpufreq_info(new_path, i);
 	}
+}
+
+static int parse_cpu_info(void)
+{
+	Self_span_t t;
+	int i;
+
+	t = self_span_begin();
+	collect_run(&collect);
+	/* Must clear all mask for cpu hotplug */
+	cpus_clear(cpu_online_map);
+	for (i = 0; i < systeminfo.nr_cpus; i++)
+		if (systeminfo.cpu[i].online)
+			cpu_set(i, cpu_online_map);
+	self_span_end(SELF_STAGE_CPUFREQ, t);
 
 	/* calc the cpu utilization for per cpu */
 	if (systeminfo.first_run_flag) {
@@ -304,10 +1020,12 @@ static int parse_cpu_info(void)
 		systeminfo.first_run_flag = 0;
 		tv.tv_sec = 0;
 		tv.tv_nsec = 500000000;	//500ms
-		do_stat();
-		nanosleep(&tv, NULL);
+		sample_counters();
+		/* a replayed capture already holds the second sample */
+		if (capture.mode != CAPTURE_REPLAY)
+			nanosleep(&tv, NULL);
 	}
-	do_stat();
+	sample_counters();
 
 	return 0;
 }
@@ -315,43 +1033,39 @@ static int parse_cpu_info(void)
 static int parse_master_tempinfo(char *path)
 {
 	char new_path[PATH_MAX];
-	FILE *file;
-	char *line = NULL;
-	size_t size = 0;
-	unsigned int temp;
+	char *line;
+	unsigned int temp = 0;
 	int ret = 0;
 
 	snprintf(new_path, ADJ_SIZE(PATH_MAX, path, "/type"), "%s/type", path);
 
-	file = fopen(new_path, "r");
-	if (!file) {
+	if (capture_read(&capture, new_path, &line) < 0) {
 		printf("No such file:%s", new_path);
 		return -EINVAL;
 	}
 
 	snprintf(new_path, ADJ_SIZE(PATH_MAX, path, "/temp"), "%s/temp", path);
-	if (getline(&line, &size, file) > 0) {
+	if (*line) {
 		if (!strncmp(line, "cpu", strlen("cpu"))) {
 			/* CPU */
-			ret = process_one_line(new_path, get_temp, &temp);
+			ret = sample_one_line(new_path, get_temp, &temp);
 			if (ret < 0) {
 				printf("read cpu temprature failed\n");
-				systeminfo.cpu_temp = 0;
+				temp = 0;
 			}
 			systeminfo.cpu_temp = temp;
 		} else if (!strncmp(line, "gpu", strlen("gpu"))) {
 			/* GPU */
-			ret = process_one_line(new_path, get_temp, &temp);
+			ret = sample_one_line(new_path, get_temp, &temp);
 			if (ret < 0) {
 				printf("read gpu temprature failed\n");
-				systeminfo.gpu_temp = 0;
+				temp = 0;
 			}
 			systeminfo.gpu_temp = temp;
 		} else {
 			printf("No support the master\n");
 		}
 	}
-	fclose(file);
 #ifdef DEBUG
 	printf("cpu temp:%u, gpu temp:%u\n", systeminfo.cpu_temp, systeminfo.gpu_temp);
 #endif
@@ -360,48 +1074,51 @@ static int parse_master_tempinfo(char *path)
 
 static int parse_system_master_temp_info()
 {
-	DIR *dir;
-	struct dirent *entry;
+	char *names, *name, *end;
 
 	/* Get master temperature */
-	/* Fix me, use macro instead of str */
-	dir = opendir(THERMAL_PATH);
-	if (!dir) {
+	if (capture_list(&capture, THERMAL_PATH, &names) < 0) {
 		printf("Need support thermal driver\n");
 		return -EINVAL;
 	}
-		do {
-			int num;
-			char pad;
-			entry = readdir(dir);
-			/*
-			 * We only want to count thermal zone
-			 */
-			if (entry &&
-			    sscanf(entry->d_name, "thermal_zone%d%c", &num, &pad) == 1 &&
-			    !strchr(entry->d_name, ' ')) {
-				char new_path[PATH_MAX];
-				snprintf(new_path, PATH_MAX, "/sys/devices/virtual/thermal/%s", entry->d_name);
-				parse_master_tempinfo(new_path);
-			}
-		} while (entry);
+	for (name = names; (end = strchr(name, '\n')); name = end + 1) {
+		int num;
+		char pad;
 
-	closedir(dir);
+		*end = '\0';
+		/*
+		 * We only want to count thermal zone
+		 */
+		if (sscanf(name, "thermal_zone%d%c", &num, &pad) == 1 &&
+		    !strchr(name, ' ')) {
+			char new_path[PATH_MAX];
+			snprintf(new_path, PATH_MAX, THERMAL_PATH "/%s", name);
+			parse_master_tempinfo(new_path);
+		}
+	}
 
 	return 0;
 }
 
 static int init_systeminfo_struct(struct systeminfo *systeminfo)
 {
-	int i = 0;
-
-	/* Get total cpu nums */
-	systeminfo->nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
-	if (systeminfo->nr_cpus < 0) {
+	unsigned int nr;
+	long nr_conf;
+	size_t size;
+
+	/* Get total cpu nums, a fixture tree or capture has its own cpu count */
+	if (capture.mode == CAPTURE_REPLAY)
+		nr_conf = capture.nr_cpus;
+	else
+		nr_conf = *sysroot ? 0 : sysconf(_SC_NPROCESSORS_CONF);
+	systeminfo->nr_cpus = nr_conf > 0 ? nr_conf : 0;
+	if (!systeminfo->nr_cpus) {
 		DIR *dir;
 		struct dirent *entry;
+		char path[PATH_MAX];
 
-		dir = opendir(CPU_PATH);
+		root_path(path, PATH_MAX, CPU_PATH);
+		dir = opendir(path);
 		if (!dir)
 			return -EINVAL;
 		do {
@@ -421,7 +1138,7 @@ static int init_systeminfo_struct(struct systeminfo *systeminfo)
 
 		closedir(dir);
 
-		if (systeminfo->nr_cpus < 0) {
+		if (!systeminfo->nr_cpus || systeminfo->nr_cpus > NR_CPUS) {
 			printf("get cpu nums error\n");
 			return -EINVAL;
 		}
@@ -435,76 +1152,659 @@ static int init_systeminfo_struct(struct systeminfo *systeminfo)
 	 * cpu0 330964 0 586465 7592474 11 202696 77311 0 0 0
 	 * cpun 4983 0 111429 10184037 1 44124 44965 0 0 0
 	 */
-	systeminfo->cur_jiffy = (Jiffy_count_t *)malloc((systeminfo->nr_cpus + 1) * sizeof(Jiffy_count_t));
-	systeminfo->prev_jiffy = (Jiffy_count_t *)malloc((systeminfo->nr_cpus + 1) * sizeof(Jiffy_count_t));
-	systeminfo->cpufreq = (unsigned int *)malloc(systeminfo->nr_cpus * sizeof(unsigned int));
-	systeminfo->cpu_rate = (char **)malloc(systeminfo->nr_cpus * sizeof(char *));
-
-	if (!systeminfo->cpufreq || !systeminfo->cur_jiffy
-		|| !systeminfo->prev_jiffy || !systeminfo->cpu_rate) {
+	/*
+	 * All per cpu state comes from one arena sized here, each array on
+	 * its own cache lines, so the ticks never touch the heap.  The
+	 * records are in cpu order, which keeps every collection shard's
+	 * records contiguous.
+	 */
+	nr = systeminfo->nr_cpus;
+	size = arena_size(nr * sizeof(Cpu_state_t)) +
+		arena_size(nr * sizeof(unsigned int)) +
+		arena_size(nr * sizeof(Emitted_row_t));
+	if (init_arena(&arena, size) < 0) {
 		printf("alloc mem for systeminfo failed\n");
 		return -ENOMEM;
 	}
+	systeminfo->cpu = arena_alloc(&arena, nr * sizeof(Cpu_state_t));
+	systeminfo->cpu_util = arena_alloc(&arena, nr * sizeof(unsigned int));
+	emitted = arena_alloc(&arena, nr * sizeof(Emitted_row_t));
+	if (!emitted)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void destroy_systeminfo_struct()
+{
+	destroy_arena(&arena);
+	systeminfo.cpu = NULL;
+	systeminfo.cpu_util = NULL;
+	emitted = NULL;
+}
+
+/* ",sched:fifo:10,mlock,..." naming the --jitter run, ",default" for none */
+static void jitter_mode(char *buf, size_t size)
+{
+	int len = 0;
+
+	if (sched_policy)
+		len += snprintf(buf + len, size - len, ",sched:%s", sched_policy);
+	if (lock_memory)
+		len += snprintf(buf + len, size - len, ",mlock");
+	if (timer_slack >= 0)
+		len += snprintf(buf + len, size - len, ",slack:%ldns", timer_slack);
+	if (housekeeping_list)
+		len += snprintf(buf + len, size - len, ",cpus:%s", housekeeping_list);
+	if (!len)
+		snprintf(buf, size, ",default");
+}
+
+/*
+ * /proc/stat moves in whole jiffies, so at a tick of a few jiffies cpu%
+ * snaps between 0 and 100.  Take it from the ns run time in schedstat
+ * then, or from the us idle time of cpuidle, whichever the kernel has.
+ * The source is opened if the shortest period is that short; do_stat()
+ * then only uses it on the ticks that actually are.
+ */
+static void init_hires_util(void)
+{
+	int period = interval;
+	long hz;
+
+	if (fast_interval && fast_interval < period)
+		period = fast_interval;
+	hz = sysconf(_SC_CLK_TCK);
+	if (capture_mode == CAPTURE_REPLAY || hz <= 0 ||
+	    (long long)period * hz >= HIRES_JIFFIES * MSEC_PER_SEC)
+		return;
 
-	for(i = 0; i < systeminfo->nr_cpus; i++) {
-		systeminfo->cpu_rate[i] = (char *)malloc(8 * sizeof(char));
-		if (!systeminfo->cpu_rate[i]) {
-			printf("alloc mem for cpu rate failed\n");
-			return -ENOMEM;
+	if (show_sched ||
+	    init_schedstat(&schedstat, systeminfo.nr_cpus) == 0) {
+		hires_source = HIRES_SCHEDSTAT;
+	} else {
+		destroy_schedstat(&schedstat);
+		if (show_cpuidle || init_cpuidle(&cpuidle, systeminfo.nr_cpus) == 0) {
+			hires_source = HIRES_CPUIDLE;
+		} else {
+			destroy_cpuidle(&cpuidle);
+			printf("%dms is under %d jiffies, cpu%% is coarse without "
+				"schedstat or cpuidle\n", period, HIRES_JIFFIES);
+			return;
 		}
 	}
+	printf("%dms is under %d jiffies, cpu%% from %s\n", period,
+		HIRES_JIFFIES, hires_source == HIRES_SCHEDSTAT ?
+		"schedstat run time" : "cpuidle residency");
+}
 
-	memset((void *)systeminfo->cur_jiffy, 0, (systeminfo->nr_cpus + 1) * sizeof(Jiffy_count_t));
-	memset((void *)systeminfo->prev_jiffy, 0, (systeminfo->nr_cpus + 1) * sizeof(Jiffy_count_t));
-	memset((void *)systeminfo->cpufreq, 0, systeminfo->nr_cpus * sizeof(unsigned int));
-	for(i = 0; i < systeminfo->nr_cpus; i++)
-		memset((void *)systeminfo->cpu_rate[i], 0, 8 * sizeof(char));
+static void display_header(void)
+{
+	printf("System info:\n");
+	if (group_by != TOPO_CPU) {
+		printf("\tCPU%%\t\tcpufreq(MHz)\t\ttemp\t\ttime\tcpus\n");
+		return;
+	}
+	printf("\tCPU%%");
+	if (show_breakdown)
+		printf("\t    usr     sys     irq    sirq   steal   guest  iowait");
+	if (show_sched)
+		printf("\twait/slice rq");
+	printf("\t\tcpufreq(MHz)\t\ttemp\t\ttime\n");
+}
 
-	return 0;
+static void display_group_info(unsigned int count)
+{
+	static const char fmt[] = "%s%d\t%s\t\t%12u\t\t%4u\t\t%u\t%s\n";
+	char line_buf[LINE_BUF_SIZE];
+	char cpus_buf[LINE_BUF_SIZE / 2];
+	char rate[8];
+	int i;
+
+	topology_rollup(&topology, &systeminfo);
+
+	for (i = 0; i < topology.nr_groups[group_by]; i++) {
+		const Topo_group_t *group = &topology.groups[group_by][i];
+		const Topo_stat_t *stat = &topology.stat[group_by][i];
+		unsigned int permille;
+
+		if (!stat->nr_online)
+			continue;
+		/* jiffies summed over a big group overflow 1000 * value in 32 bits */
+		if (!stat->total)
+			permille = 0;
+		else if (stat->busy >= stat->total)
+			permille = 1000;
+		else
+			permille = 1000ULL * stat->busy / stat->total;
+		fmt_100percent_8(rate, permille, 1000);
+		cpulist_scnprintf(cpus_buf, sizeof(cpus_buf), group->mask);
+		snprintf(line_buf, LINE_BUF_SIZE, fmt,
+			topology_level_name(group_by),
+			group->id,
+			rate,
+			(unsigned int)(stat->freq_sum / stat->nr_online),
+			systeminfo.cpu_temp,
+			count,
+			cpus_buf);
+		outbuf_write(&tick_out, line_buf, strlen(line_buf));
+	}
 }
 
-static void destroy_systeminfo_struct()
+/* Append " NAME:RES%" per C-state and the wakeup latency to a cpu row */
+static int display_cpuidle_info(char *buf, int size, int cpu)
 {
+	const Cpuidle_cpu_t *c;
+	char rate[8];
+	int len = 0;
 	int i;
 
-	if(systeminfo.cur_jiffy)
-		free(systeminfo.cur_jiffy);
-	if (systeminfo.prev_jiffy)
-		free(systeminfo.prev_jiffy);
-	if (systeminfo.cpufreq)
-		free(systeminfo.cpufreq);
+	if (cpu >= cpuidle.nr_cpus)
+		return 0;
+	c = &cpuidle.cpus[cpu];
+	for (i = 0; i < c->nr_states && len < size; i++) {
+		fmt_100percent_8(rate, c->states[i].residency, 1000);
+		len += snprintf(buf + len, size - len, "\t%s:%s",
+				c->states[i].name, rate);
+	}
+	if (len < size)
+		len += snprintf(buf + len, size - len, "\twake:%uus(%u.%u%%)",
+				c->wake_latency, c->wake_exposure / 10,
+				c->wake_exposure % 10);
+	return len;
+}
 
-	for(i = 0; i < systeminfo.nr_cpus; i++)
-		if (systeminfo.cpu_rate[i])
-			free(systeminfo.cpu_rate[i]);
+/* --breakdown columns, each class as a share of the cpu's jiffies */
+static int display_split_info(char *buf, int cpu)
+{
+	const unsigned short *split = systeminfo.cpu[cpu].split;
+	int ret = 0;
+	int i;
 
-	if (systeminfo.cpu_rate)
-		free(systeminfo.cpu_rate);
+	buf[ret++] = '\t';
+	for (i = 0; i < NR_SPLIT_SLOTS; i++)
+		ret += sprintf(buf + ret, "%s%5u.%u", i ? " " : "",
+				split[i] / 10, split[i] % 10);
+	return ret;
 }
 
-static void display_header(void)
+/* Run queue wait per timeslice and pressure, the column after CPU% */
+static int display_sched_info(char *buf, int cpu)
 {
-	printf("System info:\n");
-	printf("\tCPU%%\t\tcpufreq(MHz)\t\ttemp\t\ttime\n");
+	const Schedstat_cpu_t *c;
+
+	if (cpu >= schedstat.nr_cpus)
+		return sprintf(buf, "\t%8s %5s", "-", "-");
+	c = &schedstat.cpus[cpu];
+	return sprintf(buf, "\t%6uus %2u.%02u", c->wait_us,
+			c->rq_pressure / 100, c->rq_pressure % 100);
+}
+
+/* Append IPC, cache MPKI and context switches/s to a cpu row */
+static int display_perf_info(char *buf, int size, int cpu)
+{
+	const Perf_cpu_t *c;
+	int len;
+
+	if (cpu >= perfstat.nr_cpus)
+		return 0;
+	c = &perfstat.cpus[cpu];
+	if (c->fd[PERF_CYCLES] < 0)
+		len = snprintf(buf, size, "\tperf:-");
+	else if (perfstat.software)
+		len = snprintf(buf, size, "\tipc:- mpki:- cs:%u/s", c->ctx_rate);
+	else
+		len = snprintf(buf, size, "\tipc:%u.%02u mpki:%u.%02u cs:%u/s",
+				c->ipc / 100, c->ipc % 100,
+				c->mpki / 100, c->mpki % 100, c->ctx_rate);
+	return len < size ? len : size - 1;
+}
+
+static void display_procstat_info(unsigned int count)
+{
+	static const char fmt[] = "stat\tctxt:%llu/s intr:%llu/s softirq:%llu/s "
+		"fork:%llu/s\trunning:%llu blocked:%llu\t";
+	const Procstat_t *stat = &systeminfo.stat;
+	int i;
+
+	outbuf_printf(&tick_out, fmt,
+		stat->rate[PROCSTAT_CTXT], stat->rate[PROCSTAT_INTR],
+		stat->rate[PROCSTAT_SOFTIRQ], stat->rate[PROCSTAT_PROCESSES],
+		stat->rate[PROCSTAT_RUNNING], stat->rate[PROCSTAT_BLOCKED]);
+	for (i = 0; i < NR_SOFTIRQ_SLOTS; i++)
+		outbuf_printf(&tick_out, "%s%s:%llu/s", i ? " " : "",
+			softirq_names[i], stat->softirq_rate[i]);
+	outbuf_printf(&tick_out, "\t%u\n", count);
 }
 
-static void display_system_info(unsigned int count)
+static void display_memory_info(unsigned int count)
 {
-	static const char fmt[] = "cpu%d\t%s\t\t%12u\t\t%4u\t\t%u\n";
+	static const char fmt[] = "mem\tused:%lluM avail:%lluM cache:%lluM "
+		"dirty:%lluM swap:%lluM\tfault:%llu/s majfault:%llu/s "
+		"swpin:%llu/s swpout:%llu/s scan:%llu/s oom:%llu/s\t"
+		"psi cpu:%u.%u%% mem:%u.%u%%/%u.%u%% io:%u.%u%%/%u.%u%%\t%u\n";
+	const unsigned long long *mi = memstat.meminfo.cur;
+	const unsigned long long *rate = memstat.rate;
+	const Psi_stat_t *psi = memstat.psi;
+	unsigned long long used;
+
+	used = mi[MEMINFO_TOTAL] - mi[MEMINFO_FREE] - mi[MEMINFO_BUFFERS]
+		- mi[MEMINFO_CACHED];
+	outbuf_printf(&tick_out, fmt,
+		used >> 10,
+		mi[MEMINFO_AVAILABLE] >> 10,
+		(mi[MEMINFO_BUFFERS] + mi[MEMINFO_CACHED]) >> 10,
+		(mi[MEMINFO_DIRTY] + mi[MEMINFO_WRITEBACK]) >> 10,
+		(mi[MEMINFO_SWAP_TOTAL] - mi[MEMINFO_SWAP_FREE]) >> 10,
+		rate[VMSTAT_PGFAULT], rate[VMSTAT_PGMAJFAULT],
+		rate[VMSTAT_PSWPIN], rate[VMSTAT_PSWPOUT],
+		rate[VMSTAT_PGSCAN_KSWAPD] + rate[VMSTAT_PGSCAN_DIRECT],
+		rate[VMSTAT_OOM_KILL],
+		psi[PSI_CPU].some / 10, psi[PSI_CPU].some % 10,
+		psi[PSI_MEMORY].some / 10, psi[PSI_MEMORY].some % 10,
+		psi[PSI_MEMORY].full / 10, psi[PSI_MEMORY].full % 10,
+		psi[PSI_IO].some / 10, psi[PSI_IO].some % 10,
+		psi[PSI_IO].full / 10, psi[PSI_IO].full % 10,
+		count);
+}
+
+static void display_dev_info(unsigned int count)
+{
+	static const char disk_fmt[] = "disk\t%s\trd:%lluKB/s wr:%lluKB/s "
+		"r:%llu/s w:%llu/s util:%u.%u%%\t%u\n";
+	static const char net_fmt[] = "net\t%s\trx:%lluKB/s tx:%lluKB/s "
+		"rxpkt:%llu/s txpkt:%llu/s drop:%llu/s\t%u\n";
+	int i;
+
+	for (i = 0; show_disk && i < diskstat.nr_devs; i++) {
+		const unsigned long long *rate = &diskstat.rate[i * NR_DISK_FIELDS];
+		/* io_ticks is ms per second, 1000 means always busy */
+		unsigned int util = rate[DISK_IO_TICKS] > 1000 ? 1000 :
+					rate[DISK_IO_TICKS];
+
+		outbuf_printf(&tick_out, disk_fmt, diskstat.names[i],
+			rate[DISK_RD_SECTORS] / 2, rate[DISK_WR_SECTORS] / 2,
+			rate[DISK_RD_IOS], rate[DISK_WR_IOS],
+			util / 10, util % 10, count);
+	}
+
+	for (i = 0; show_net && i < netstat.nr_devs; i++) {
+		const unsigned long long *rate = &netstat.rate[i * NR_NET_FIELDS];
+
+		outbuf_printf(&tick_out, net_fmt, netstat.names[i],
+			rate[NET_RX_BYTES] >> 10, rate[NET_TX_BYTES] >> 10,
+			rate[NET_RX_PACKETS], rate[NET_TX_PACKETS],
+			rate[NET_RX_DROP] + rate[NET_TX_DROP], count);
+	}
+}
+
+static inline unsigned int abs_diff(unsigned int a, unsigned int b)
+{
+	return a > b ? a - b : b - a;
+}
+
+/*
+ * --changes-only: decide from the numeric per cpu state whether the row
+ * of @cpu moved past a deadband since it was last printed.
+ */
+static int cpu_row_changed(int cpu)
+{
+	const Emitted_row_t *row = &emitted[cpu];
+
+	return abs_diff(systeminfo.cpu_util[cpu], row->util) > util_deadband ||
+		abs_diff(systeminfo.cpu[cpu].cpufreq, row->freq) > freq_deadband ||
+		abs_diff(systeminfo.cpu_temp, row->temp) > temp_deadband;
+}
+
+/* Returns the number of rows printed for this tick */
+static int display_system_info(unsigned int count)
+{
+	static const char fmt[] = "\t\t%12u\t\t%4u\t\t%u";
+	static cpumask_t emitted_online_map;
 	char line_buf[LINE_BUF_SIZE];
+	int keyframe = 1;
+	int rows = 0;
 	int ret;
 	int i;
 
+	if (!cpus_empty(steal_map)) {
+		char cpus_buf[LINE_BUF_SIZE];
+
+		cpulist_scnprintf(cpus_buf, sizeof(cpus_buf), steal_map);
+		outbuf_printf(&tick_out, "steal\tcpus:%s\tmax:%u.%u%%\t%u\n",
+			cpus_buf, systeminfo.max_steal / 10,
+			systeminfo.max_steal % 10, count);
+		rows++;
+	}
+	if (show_procstat || show_memory || show_disk || show_net)
+		rows++;
+	if (show_procstat)
+		display_procstat_info(count);
+	if (show_memory)
+		display_memory_info(count);
+	if (show_disk || show_net)
+		display_dev_info(count);
+
+	if (group_by != TOPO_CPU) {
+		display_group_info(count);
+		return rows + 1;
+	}
+
+	if (changes_only) {
+		/*
+		 * Keyframes print every cpu so a reader joining the stream
+		 * late, or after hotplug, has a full picture again.
+		 */
+		keyframe = count == 1 || count % keyframe_ticks == 0 ||
+			!cpus_equal(emitted_online_map, cpu_online_map);
+		emitted_online_map = cpu_online_map;
+		if (keyframe)
+			outbuf_printf(&tick_out, "keyframe\t%u\n", count);
+	}
+
 	for_each_online_cpu(i) {
-		ret = sprintf(line_buf, fmt,
-			i,
-			systeminfo.cpu_rate[i],
-			systeminfo.cpufreq[i],
+		if (changes_only) {
+			if (!keyframe && !cpu_row_changed(i))
+				continue;
+			emitted[i].util = systeminfo.cpu_util[i];
+			emitted[i].freq = systeminfo.cpu[i].cpufreq;
+			emitted[i].temp = systeminfo.cpu_temp;
+		}
+		ret = sprintf(line_buf, "cpu%d\t%s", i, systeminfo.cpu[i].rate);
+		if (show_breakdown)
+			ret += display_split_info(line_buf + ret, i);
+		if (show_sched)
+			ret += display_sched_info(line_buf + ret, i);
+		ret += sprintf(line_buf + ret, fmt,
+			systeminfo.cpu[i].cpufreq,
 			systeminfo.cpu_temp,
 			count);
-		fputs(line_buf, stdout);
-		fflush(NULL);
+		if (show_cpuidle)
+			ret += display_cpuidle_info(line_buf + ret,
+					LINE_BUF_SIZE - ret - 1, i);
+		if (show_perf && ret < LINE_BUF_SIZE - 1)
+			ret += display_perf_info(line_buf + ret,
+					LINE_BUF_SIZE - ret - 1, i);
+		line_buf[ret++] = '\n';
+		line_buf[ret] = '\0';
+		outbuf_write(&tick_out, line_buf, ret);
+		rows++;
+	}
+	return rows;
+}
+
+/* @reset starts a new summary period for the quantile sketch */
+static void display_summary(int reset)
+{
+	static const char fmt[] = "summary\tcpu%d\tema:%s\tmin:%s\tmax:%s"
+		"\tp50:%s\tp90:%s\tp99:%s\tsamples:%u\n";
+	char ema[8], lo[8], hi[8], p50[8], p90[8], p99[8];
+	int i;
+
+	for (i = 0; i < stats.nr_cpus; i++) {
+		const Cpu_stats_t *c = &stats.cpus[i];
+
+		if (!c->nr_samples)
+			continue;
+		outbuf_printf(&tick_out, fmt, i,
+			fmt_100percent_8(ema, (unsigned)(c->ema + 0.5), STATS_MAX_VALUE),
+			fmt_100percent_8(lo, stats_min(&stats, i), STATS_MAX_VALUE),
+			fmt_100percent_8(hi, stats_max(&stats, i), STATS_MAX_VALUE),
+			fmt_100percent_8(p50, stats_quantile(&stats, i, 0.50), STATS_MAX_VALUE),
+			fmt_100percent_8(p90, stats_quantile(&stats, i, 0.90), STATS_MAX_VALUE),
+			fmt_100percent_8(p99, stats_quantile(&stats, i, 0.99), STATS_MAX_VALUE),
+			c->nr_samples);
+	}
+	outbuf_printf(&tick_out, "\n");
+	if (reset)
+		stats_reset_sketch(&stats);
+}
+
+static void stop_handler(int sig)
+{
+	stop_requested = 1;
+}
+
+static void msec_to_timespec(int msec, struct timespec *tv)
+{
+	tv->tv_sec = msec / MSEC_PER_SEC;
+	tv->tv_nsec = (msec % MSEC_PER_SEC) * NSEC_PER_MSEC;
+}
+
+/*
+ * Adaptive mode scheduler: any anomaly in the tick just sampled drops the
+ * period to fast_interval and holds it for adaptive_hold ms.  Once quiet,
+ * the period doubles each tick until it is back at -d.
+ */
+static int adaptive_next_period(int period, unsigned int elapsed_ms,
+				const char **reason)
+{
+	static unsigned long long last_anomaly_ns;
+	static unsigned int prev_temp;
+	static cpumask_t prev_online_map;
+	unsigned long long now = monotonic_ns();
+	const char *why = NULL;
+
+	if (systeminfo.max_util >= busy_threshold * 10)
+		why = "busy";
+	else if (elapsed_ms && systeminfo.max_util_delta * MSEC_PER_SEC >=
+			util_rate * 10 * elapsed_ms)
+		why = "util-rate";
+	/* thermal zones report millidegree C */
+	else if (elapsed_ms && prev_temp && systeminfo.cpu_temp > prev_temp &&
+			(systeminfo.cpu_temp - prev_temp) >= temp_rate * elapsed_ms)
+		why = "temp-rate";
+	else if (!cpus_empty(steal_map))
+		why = "steal";
+	else if (systeminfo.hotplug ||
+			(elapsed_ms && !cpus_equal(prev_online_map, cpu_online_map)))
+		why = "hotplug";
+
+	prev_temp = systeminfo.cpu_temp;
+	prev_online_map = cpu_online_map;
+
+	*reason = why ? why : "idle";
+	if (why) {
+		last_anomaly_ns = now;
+		return fast_interval;
+	}
+	if (last_anomaly_ns &&
+	    now - last_anomaly_ns < adaptive_hold * NSEC_PER_MSEC) {
+		*reason = "hold";
+		return fast_interval;
+	}
+	period *= 2;
+	return period > interval ? interval : period;
+}
+
+/* Take the samples of one tick; -ENODATA once a replayed capture is done */
+static int sample_tick(void)
+{
+	Self_span_t t;
+	int ret;
+
+	ret = capture_tick(&capture);
+	if (ret < 0)
+		return ret;
+	t = self_span_begin();
+	parse_system_master_temp_info();
+	self_span_end(SELF_STAGE_TEMP, t);
+	parse_cpu_info();
+	/* after the first tick's warm-up sample, which only seeds last_ns */
+	if (show_jitter)
+		jitter_record(&jitter, monotonic_ns());
+	return 0;
+}
+
+/* Sample and render one tick into the daemon history slot @out */
+static void daemon_tick_cb(Outbuf_t *out)
+{
+	static unsigned int sample_count;
+	Self_span_t t;
+
+	sample_tick();
+	sample_count++;
+	stats_update(&stats, systeminfo.cpu_util, &cpu_online_map);
+	t = self_span_begin();
+	display_system_info(sample_count);
+	self_span_end(SELF_STAGE_DISPLAY, t);
+	outbuf_copy(out, &tick_out);
+	outbuf_reset(&tick_out);
+}
+
+/* Quantiles cover the whole daemon lifetime, min/max the last --window */
+static void daemon_summary_cb(Outbuf_t *out)
+{
+	display_summary(0);
+	outbuf_copy(out, &tick_out);
+	outbuf_reset(&tick_out);
+}
+
+/* Prometheus text exposition format, base units */
+static void daemon_metrics_cb(Outbuf_t *out)
+{
+	static unsigned long long ticks;
+	int i;
+
+	outbuf_printf(out, "# HELP system_monitor_cpu_online Whether the cpu is online.\n"
+			"# TYPE system_monitor_cpu_online gauge\n");
+	for (i = 0; i < systeminfo.nr_cpus; i++)
+		outbuf_printf(out, "system_monitor_cpu_online{cpu=\"%d\"} %d\n",
+			i, cpu_isset(i, cpu_online_map) ? 1 : 0);
+
+	outbuf_printf(out, "# HELP system_monitor_cpu_utilization_ratio Busy share of the last tick.\n"
+			"# TYPE system_monitor_cpu_utilization_ratio gauge\n");
+	for_each_online_cpu(i)
+		outbuf_printf(out, "system_monitor_cpu_utilization_ratio{cpu=\"%d\"} %u.%03u\n",
+			i, systeminfo.cpu_util[i] / 1000, systeminfo.cpu_util[i] % 1000);
+
+	outbuf_printf(out, "# HELP system_monitor_cpu_steal_ratio Share of the last tick the hypervisor ran something else.\n"
+			"# TYPE system_monitor_cpu_steal_ratio gauge\n");
+	for_each_online_cpu(i)
+		outbuf_printf(out, "system_monitor_cpu_steal_ratio{cpu=\"%d\"} %u.%03u\n",
+			i, systeminfo.cpu[i].split[SPLIT_STEAL] / 1000,
+			systeminfo.cpu[i].split[SPLIT_STEAL] % 1000);
+
+	outbuf_printf(out, "# HELP system_monitor_cpu_frequency_hertz Current cpu frequency.\n"
+			"# TYPE system_monitor_cpu_frequency_hertz gauge\n");
+	for_each_online_cpu(i)
+		outbuf_printf(out, "system_monitor_cpu_frequency_hertz{cpu=\"%d\"} %llu\n",
+			i, systeminfo.cpu[i].cpufreq * 1000000ULL);
+
+	outbuf_printf(out, "# HELP system_monitor_temperature_celsius Thermal zone temperature.\n"
+			"# TYPE system_monitor_temperature_celsius gauge\n"
+			"system_monitor_temperature_celsius{zone=\"cpu\"} %u.%03u\n"
+			"system_monitor_temperature_celsius{zone=\"gpu\"} %u.%03u\n",
+			systeminfo.cpu_temp / 1000, systeminfo.cpu_temp % 1000,
+			systeminfo.gpu_temp / 1000, systeminfo.gpu_temp % 1000);
+
+	/* read with the cpu lines anyway, so always exported */
+	outbuf_printf(out, "# HELP system_monitor_context_switches_total Context switches on all cpus.\n"
+			"# TYPE system_monitor_context_switches_total counter\n"
+			"system_monitor_context_switches_total %llu\n"
+			"# HELP system_monitor_interrupts_total Interrupts serviced on all cpus.\n"
+			"# TYPE system_monitor_interrupts_total counter\n"
+			"system_monitor_interrupts_total %llu\n"
+			"# HELP system_monitor_forks_total Processes and threads created.\n"
+			"# TYPE system_monitor_forks_total counter\n"
+			"system_monitor_forks_total %llu\n"
+			"# HELP system_monitor_procs_running Runnable tasks.\n"
+			"# TYPE system_monitor_procs_running gauge\n"
+			"system_monitor_procs_running %llu\n"
+			"# HELP system_monitor_procs_blocked Tasks blocked on I/O.\n"
+			"# TYPE system_monitor_procs_blocked gauge\n"
+			"system_monitor_procs_blocked %llu\n",
+			systeminfo.stat.cur[PROCSTAT_CTXT],
+			systeminfo.stat.cur[PROCSTAT_INTR],
+			systeminfo.stat.cur[PROCSTAT_PROCESSES],
+			systeminfo.stat.cur[PROCSTAT_RUNNING],
+			systeminfo.stat.cur[PROCSTAT_BLOCKED]);
+	outbuf_printf(out, "# HELP system_monitor_softirqs_total Softirqs run on all cpus.\n"
+			"# TYPE system_monitor_softirqs_total counter\n");
+	for (i = 0; i < NR_SOFTIRQ_SLOTS; i++)
+		outbuf_printf(out, "system_monitor_softirqs_total{vector=\"%s\"} %llu\n",
+			softirq_names[i], systeminfo.stat.softirq[i]);
+
+	if (show_perf) {
+		outbuf_printf(out, "# HELP system_monitor_cpu_context_switches_total Context switches seen by the perf group.\n"
+				"# TYPE system_monitor_cpu_context_switches_total counter\n");
+		for_each_online_cpu(i)
+			if (i < perfstat.nr_cpus &&
+			    perfstat.cpus[i].slot[PERF_CTX_SWITCHES] >= 0)
+				outbuf_printf(out, "system_monitor_cpu_context_switches_total{cpu=\"%d\"} %llu\n",
+					i, perfstat.cpus[i].value[PERF_CTX_SWITCHES]);
+	}
+	if (show_sched) {
+		outbuf_printf(out, "# HELP system_monitor_cpu_run_delay_seconds_total Time tasks waited on the run queue.\n"
+				"# TYPE system_monitor_cpu_run_delay_seconds_total counter\n");
+		for_each_online_cpu(i)
+			if (i < schedstat.nr_cpus)
+				outbuf_printf(out, "system_monitor_cpu_run_delay_seconds_total{cpu=\"%d\"} %llu.%09llu\n",
+					i, schedstat.cpus[i].run_delay / NSEC_PER_SEC,
+					schedstat.cpus[i].run_delay % NSEC_PER_SEC);
+		outbuf_printf(out, "# HELP system_monitor_cpu_timeslices_total Timeslices run on the cpu.\n"
+				"# TYPE system_monitor_cpu_timeslices_total counter\n");
+		for_each_online_cpu(i)
+			if (i < schedstat.nr_cpus)
+				outbuf_printf(out, "system_monitor_cpu_timeslices_total{cpu=\"%d\"} %llu\n",
+					i, schedstat.cpus[i].pcount);
+	}
+	if (show_perf && !perfstat.software) {
+		outbuf_printf(out, "# HELP system_monitor_cpu_ipc Instructions per cycle of the last tick.\n"
+				"# TYPE system_monitor_cpu_ipc gauge\n");
+		for_each_online_cpu(i)
+			if (i < perfstat.nr_cpus)
+				outbuf_printf(out, "system_monitor_cpu_ipc{cpu=\"%d\"} %u.%02u\n",
+					i, perfstat.cpus[i].ipc / 100,
+					perfstat.cpus[i].ipc % 100);
+		outbuf_printf(out, "# HELP system_monitor_cpu_cache_mpki Cache misses per 1000 instructions of the last tick.\n"
+				"# TYPE system_monitor_cpu_cache_mpki gauge\n");
+		for_each_online_cpu(i)
+			if (i < perfstat.nr_cpus)
+				outbuf_printf(out, "system_monitor_cpu_cache_mpki{cpu=\"%d\"} %u.%02u\n",
+					i, perfstat.cpus[i].mpki / 100,
+					perfstat.cpus[i].mpki % 100);
 	}
+
+	outbuf_printf(out, "# HELP system_monitor_ticks_total Samples taken since start.\n"
+			"# TYPE system_monitor_ticks_total counter\n"
+			"system_monitor_ticks_total %llu\n", ++ticks);
+}
+
+static const Daemon_ops_t monitor_daemon_ops = {
+	.tick		= daemon_tick_cb,
+	.summary	= daemon_summary_cb,
+	.metrics	= daemon_metrics_cb,
+};
+
+/* cpu_monitor client [--socket PATH] [request] */
+static int client_main(int argc, char **argv)
+{
+	static struct option client_opts[] = {
+		{ "socket", 1, NULL, OPT_SOCKET },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	char request[64] = "snapshot";
+	int c, ret;
+
+	while ((c = getopt_long(argc, argv, "h", client_opts, NULL)) != -1) {
+		if (c != OPT_SOCKET) {
+			usage();
+			return 1;
+		}
+		socket_path = optarg;
+	}
+	/* "last 5" may come as one or two words */
+	if (optind < argc) {
+		request[0] = '\0';
+		for (c = optind; c < argc; c++)
+			snprintf(request + strlen(request), sizeof(request) - strlen(request),
+				"%s%s", c > optind ? " " : "", argv[c]);
+	}
+
+	ret = daemon_client(socket_path, request);
+	return ret < 0 ? 1 : 0;
 }
 
 int main(int argc, char *argv[])
@@ -512,18 +1812,34 @@ int main(int argc, char *argv[])
 	int ret = 0;
 	unsigned int sample_count = 0;
 	struct timespec tv;
+	int period;
+	unsigned long long last_ns = 0;
+	unsigned long long start_ns;
+
+	if (argc > 1 && !strcmp(argv[1], "client"))
+		return client_main(argc - 1, argv + 1);
 
 	parse_command_line(argc, argv);
-	if (interval > MSEC_PER_SEC) {
-		tv.tv_sec = interval / MSEC_PER_SEC;
-		interval = interval % MSEC_PER_SEC;
-	} else {
-		tv.tv_sec = 0;
-	}
-	tv.tv_nsec = interval * NSEC_PER_MSEC;
+	period = interval;
+	msec_to_timespec(period, &tv);
 #ifdef DEBUG
 	printf("interval:%d, count=%d\n", interval, count);
 #endif
+	if (capture_mode == CAPTURE_REPLAY) {
+		if (daemon_mode || listen_addr) {
+			printf("--replay runs in the foreground only\n");
+			return 1;
+		}
+		if (show_cpuidle || show_perf || show_sched || show_memory ||
+		    show_disk || show_net) {
+			printf("cpuidle, perf, schedstat, memory, disk and net are not recorded, ignored\n");
+			show_cpuidle = show_perf = show_sched = 0;
+			show_memory = show_disk = show_net = 0;
+		}
+		ret = init_capture(&capture, capture_mode, capture_dir, 0);
+		if (ret < 0)
+			return 1;
+	}
 	ret = init_systeminfo_struct(&systeminfo);
 	if (ret < 0) {
 		printf("cpu_monitor init error\n");
@@ -532,20 +1848,205 @@ int main(int argc, char *argv[])
 #ifdef DEBUG
 	printf("nr_cpus: %d\n", systeminfo.nr_cpus);
 #endif
+	if (capture_mode == CAPTURE_RECORD) {
+		ret = init_capture(&capture, capture_mode, capture_dir,
+					systeminfo.nr_cpus);
+		if (ret < 0)
+			return 1;
+	}
+	/* a replay has no live cpus to spare */
+	if (capture_mode != CAPTURE_REPLAY && init_isolation(&isolation) > 0) {
+		audit_cpus = isolation.quiet;
+		if (!use_isolation) {
+			cpus_clear(isolation.quiet);
+		} else {
+			printf("isolated/nohz_full cpus: scaling_cur_freq, no perf, "
+				"threads on housekeeping cpus\n");
+			/* a fixture's cpus are not ours to pin to */
+			if (!*sysroot && !housekeeping_list)
+				isolation_pin(&isolation.housekeeping);
+		}
+	} else {
+		audit_cpus = isolation.housekeeping;
+	}
+	/* collection threads inherit affinity, policy and timer slack */
+	if (housekeeping_list && isolation_pin(&housekeeping_cpus) < 0)
+		return 1;
+	if (sched_policy && isolation_set_sched(sched_policy) < 0)
+		return 1;
+	if (timer_slack >= 0 && isolation_timer_slack(timer_slack) < 0)
+		return 1;
+	/* the capture buffers are shared, record and replay read in order */
+	if (capture_mode != CAPTURE_OFF && collect_threads > 1) {
+		printf("--threads ignored with --record/--replay\n");
+		collect_threads = 1;
+	}
+	ret = init_collect(&collect, collect_threads, systeminfo.nr_cpus,
+				parse_cpufreq_shard, NULL);
+	if (ret < 0) {
+		printf("cpu_monitor collect init error\n");
+		return ret;
+	}
+	if (group_by != TOPO_CPU) {
+		ret = init_topology(&topology, systeminfo.nr_cpus);
+		if (ret < 0) {
+			printf("cpu_monitor topology init error\n");
+			return ret;
+		}
+	}
+	if (show_cpuidle && init_cpuidle(&cpuidle, systeminfo.nr_cpus) < 0) {
+		destroy_cpuidle(&cpuidle);
+		show_cpuidle = 0;
+	}
+	if (show_perf && init_perfstat(&perfstat, systeminfo.nr_cpus) < 0) {
+		destroy_perfstat(&perfstat);
+		show_perf = 0;
+	}
+	perfstat.skip = isolation.quiet;
+	if (show_sched && init_schedstat(&schedstat, systeminfo.nr_cpus) < 0) {
+		destroy_schedstat(&schedstat);
+		show_sched = 0;
+	}
+	init_hires_util();
+	if (show_memory && init_memstat(&memstat) < 0) {
+		destroy_memstat(&memstat);
+		show_memory = 0;
+	}
+	if (show_disk && init_dev_table(&diskstat, 0) < 0) {
+		destroy_dev_table(&diskstat);
+		show_disk = 0;
+	}
+	if (show_net && init_dev_table(&netstat, 1) < 0) {
+		destroy_dev_table(&netstat);
+		show_net = 0;
+	}
+	if (summary_ticks >= 0 || daemon_mode || listen_addr) {
+		if (!stats_window)
+			stats_window = summary_ticks > 0 ? summary_ticks : 60;
+		ret = init_stats(&stats, systeminfo.nr_cpus, stats_window);
+		if (ret < 0) {
+			printf("cpu_monitor stats init error\n");
+			return ret;
+		}
+	}
+	if (outbuf_init(&tick_out, LINE_BUF_SIZE * 4) < 0) {
+		printf("alloc mem for output failed\n");
+		return -ENOMEM;
+	}
+	/* every buffer is allocated by now, lock after the last one */
+	if (lock_memory && isolation_lock_memory() < 0)
+		return 1;
+	if (irq_audit && init_irq_audit(&irqaudit, systeminfo.nr_cpus) < 0) {
+		destroy_irq_audit(&irqaudit);
+		irq_audit = 0;
+	}
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	if (daemon_mode || listen_addr) {
+		Daemon_conf_t conf = {
+			/* --listen alone does not open the query socket */
+			.socket_path	= daemon_mode ? socket_path : NULL,
+			.listen		= listen_addr,
+			.interval	= interval,
+			.history	= daemon_history,
+		};
+
+		ret = daemon_run(&conf, &monitor_daemon_ops, &stop_requested);
+		if (ret < 0)
+			printf("cpu_monitor daemon error:%s\n", strerror(-ret));
+		goto out;
+	}
 	display_header();
+	start_ns = monotonic_ns();
 	/* main loop */
 	for(;;) {
-		parse_system_master_temp_info();
-		parse_cpu_info();
+		unsigned long long now;
+		unsigned int elapsed_ms;
+		const char *reason;
+		Self_span_t t;
+		int rows;
+
+		now = monotonic_ns();
+		elapsed_ms = last_ns ? (now - last_ns) / NSEC_PER_MSEC : 0;
+		last_ns = now;
+
+		ret = sample_tick();
+		if (ret < 0) {
+			if (ret != -ENODATA)
+				printf("capture failed:%s\n", strerror(-ret));
+			break;
+		}
 		sample_count++;
-		display_system_info(sample_count);
-		printf("\n");
+		if (fast_interval) {
+			period = adaptive_next_period(period, elapsed_ms, &reason);
+			/* tag the record with the period it actually covers */
+			outbuf_printf(&tick_out, "tick:%u\tperiod:%ums\tnext:%dms\tmode:%s\n",
+				sample_count, elapsed_ms, period, reason);
+			msec_to_timespec(period, &tv);
+		}
+		if (summary_ticks >= 0) {
+			stats_update(&stats, systeminfo.cpu_util, &cpu_online_map);
+			if (summary_ticks && sample_count % summary_ticks == 0)
+				display_summary(1);
+		} else {
+			t = self_span_begin();
+			rows = display_system_info(sample_count);
+			self_span_end(SELF_STAGE_DISPLAY, t);
+			if (rows)
+				outbuf_printf(&tick_out, "\n");
+		}
+		outbuf_flush(&tick_out, stdout);
 		if (count > 0) {
 			if (--count == 0)
 				break;
 		}
+		if (stop_requested)
+			break;
+		if (capture.mode == CAPTURE_REPLAY)
+			continue;
 		nanosleep(&tv, NULL);
+		if (stop_requested)
+			break;
+	}
+	if (ret == -ENODATA)
+		ret = 0;
+	if (capture.mode == CAPTURE_REPLAY) {
+		unsigned long long ns = monotonic_ns() - start_ns;
+
+		fprintf(stderr, "replay\tticks:%u\ttime:%llums\trate:%.0f ticks/s\n",
+			sample_count, ns / NSEC_PER_MSEC,
+			ns ? (double)sample_count * NSEC_PER_SEC / ns : 0.0);
+	}
+	/* flush the partial summary period */
+	if (summary_ticks >= 0 && (!summary_ticks || sample_count % summary_ticks)) {
+		display_summary(1);
+		outbuf_flush(&tick_out, stdout);
 	}
+out:
+	if (self_stats)
+		selfstat_report();
+	if (irq_audit)
+		irq_audit_report(&irqaudit, &audit_cpus);
+	if (show_jitter) {
+		char mode[LINE_BUF_SIZE];
+
+		jitter_mode(mode, sizeof(mode));
+		jitter_report(&jitter, mode + 1);
+	}
+	destroy_irq_audit(&irqaudit);
+	destroy_outbuf(&tick_out);
+	destroy_stats(&stats);
+	destroy_dev_table(&netstat);
+	destroy_dev_table(&diskstat);
+	/* never initialized without -m, its fds would read as stdin */
+	if (show_memory)
+		destroy_memstat(&memstat);
+	destroy_cpuidle(&cpuidle);
+	destroy_perfstat(&perfstat);
+	destroy_schedstat(&schedstat);
+	destroy_topology(&topology);
+	destroy_collect(&collect);
 	destroy_systeminfo_struct();
-	return 0;
+	destroy_capture(&capture);
+	return ret < 0 ? 1 : 0;
 }
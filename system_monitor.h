@@ -1,12 +1,26 @@
 #ifndef _SYSTEM_MONITOR_H_
 #define _SYSTEM_MONITOR_H_
 
+#include <sys/types.h>
+#include <time.h>
+
+#include "arena.h"
+
 #define PATH_MAX	4096	/* # chars in a path name including nul */
 #define CPU_PATH	"/sys/devices/system/cpu"
+#define NODE_PATH	"/sys/devices/system/node"
 #define THERMAL_PATH	"/sys/devices/virtual/thermal"
 #define STAT_PATH	"/proc/stat"
+#define MEMINFO_PATH	"/proc/meminfo"
+#define VMSTAT_PATH	"/proc/vmstat"
+#define PSI_PATH	"/proc/pressure"
+#define SCHEDSTAT_PATH	"/proc/schedstat"
+#define INTERRUPTS_PATH	"/proc/interrupts"
+#define DISKSTATS_PATH	"/proc/diskstats"
+#define NETDEV_PATH	"/proc/net/dev"
 #define ADJ_SIZE(l,r,s) (l-strlen(r)-strlen(#s))
 #define LINE_BUF_SIZE	1024
+#define CPU_RATE_LEN	8	//"100.0%" from fmt_100percent_8() and the NUL
 
 /* Parameters used to convert the timespec values: */
 #define MSEC_PER_SEC	1000L
@@ -21,18 +35,107 @@
 typedef struct jiffy_counts_t {
 	unsigned long long usr, nic, sys, idle;
 	unsigned long long iowait, irq, softirq, steal;
+	unsigned long long guest, guest_nice;	//already counted in usr/nic
 	unsigned long long total;
 	unsigned long long busy;
 }Jiffy_count_t;
 
+/* Where a cpu's time went over the last tick, see Cpu_state_t.split */
+enum cpu_split_slot {
+	SPLIT_USR = 0,		//usr and nice, guest time taken out
+	SPLIT_SYS,
+	SPLIT_IRQ,
+	SPLIT_SOFTIRQ,
+	SPLIT_STEAL,		//runnable but the hypervisor ran someone else
+	SPLIT_GUEST,		//running a guest of our own
+	SPLIT_IOWAIT,
+	NR_SPLIT_SLOTS
+};
+
+/* System wide values of /proc/stat after the cpu lines */
+enum procstat_slot {
+	PROCSTAT_CTXT = 0,	//context switches
+	PROCSTAT_INTR,		//interrupts, all sources
+	PROCSTAT_SOFTIRQ,	//softirqs, all vectors
+	PROCSTAT_PROCESSES,	//forks
+	PROCSTAT_RUNNING,	//runnable tasks, a gauge
+	PROCSTAT_BLOCKED,	//tasks blocked on I/O, a gauge
+	NR_PROCSTAT_SLOTS
+};
+
+/* Vectors of the "softirq" line, in kernel order */
+enum softirq_slot {
+	SOFTIRQ_HI = 0,
+	SOFTIRQ_TIMER,
+	SOFTIRQ_NET_TX,
+	SOFTIRQ_NET_RX,
+	SOFTIRQ_BLOCK,
+	SOFTIRQ_IRQ_POLL,
+	SOFTIRQ_TASKLET,
+	SOFTIRQ_SCHED,
+	SOFTIRQ_HRTIMER,
+	SOFTIRQ_RCU,
+	NR_SOFTIRQ_SLOTS
+};
+
+typedef struct procstat {
+	unsigned long long cur[NR_PROCSTAT_SLOTS], prev[NR_PROCSTAT_SLOTS];
+	unsigned long long rate[NR_PROCSTAT_SLOTS];	//per second, gauges as read
+	unsigned long long softirq[NR_SOFTIRQ_SLOTS], prev_softirq[NR_SOFTIRQ_SLOTS];
+	unsigned long long softirq_rate[NR_SOFTIRQ_SLOTS];
+	unsigned long long last_ns, elapsed_ns;
+}Procstat_t;
+
+/*
+ * Everything a tick writes for one cpu.  Records are padded to whole
+ * cache lines so collection threads writing neighbouring cpus never
+ * share a line; make CPU_STATE_PACKED=1 drops the padding to measure it.
+ */
+#ifdef CPU_STATE_PACKED
+#define CPU_STATE_ALIGN
+#else
+#define CPU_STATE_ALIGN	__attribute__((aligned(CACHE_LINE_SIZE)))
+#endif
+
+typedef struct cpu_state {
+	Jiffy_count_t	cur_jiffy, prev_jiffy;
+	unsigned int	cpufreq;		//cpu current freq info
+	int		online;			//online file of the last tick said so
+	char		rate[CPU_RATE_LEN];	//cpu% text of the last tick
+	unsigned short	split[NR_SPLIT_SLOTS];	//0.1% units of the last tick
+} CPU_STATE_ALIGN Cpu_state_t;
+
 typedef struct systeminfo {
 	int		first_run_flag;
-	unsigned int	*cpufreq;		//cpu current freq info
 	unsigned int	nr_cpus;		//total cpus num
 	unsigned int	cpu_temp;
 	unsigned int	gpu_temp;
-	Jiffy_count_t *cur_jiffy, *prev_jiffy;
-	char	**cpu_rate;
+	Jiffy_count_t	cur_jiffy, prev_jiffy;	//the "cpu" summary line
+	Cpu_state_t	*cpu;			//nr_cpus records, cpu order
+	unsigned int	*cpu_util;		//per cpu utilization, 0.1% units
+	unsigned int	max_util;		//highest cpu_util of the last tick
+	unsigned int	max_util_delta;		//largest cpu_util change of the last tick
+	unsigned int	max_steal;		//highest steal of the last tick, 0.1%
+	int		hotplug;		//a cpu went offline/online in the last tick
+	Procstat_t	stat;			//the lines after the cpu lines
 }Systeminfo_t;
 
+static inline unsigned long long monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Prefix of every /proc and /sys path, "" for the live system */
+extern const char *sysroot;
+
+int root_path(char *buf, size_t size, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+int process_one_line(const char *path, void (*cb)(char *line, void *data), void *data);
+ssize_t pread_one_line(int fd, char *buf, size_t size);
+ssize_t pread_whole_file(int fd, char **buf, size_t *size);
+void raise_nofile_limit(void);
+
 #endif
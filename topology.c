@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cpumask.h"
+#include "system_monitor.h"
+#include "topology.h"
+
+static const char *level_names[NR_TOPO_LEVELS] = {
+	[TOPO_CPU]	= "cpu",
+	[TOPO_CORE]	= "core",
+	[TOPO_LLC]	= "llc",
+	[TOPO_PACKAGE]	= "package",
+	[TOPO_NODE]	= "node",
+};
+
+int topology_level_parse(const char *name)
+{
+	int i;
+
+	/* SMT siblings are exactly the cpus of one core */
+	if (!strcmp(name, "smt"))
+		return TOPO_CORE;
+	if (!strcmp(name, "socket") || !strcmp(name, "pkg"))
+		return TOPO_PACKAGE;
+	if (!strcmp(name, "numa"))
+		return TOPO_NODE;
+
+	for (i = 0; i < NR_TOPO_LEVELS; i++)
+		if (!strcmp(name, level_names[i]))
+			return i;
+	return -EINVAL;
+}
+
+const char *topology_level_name(int level)
+{
+	if (level < 0 || level >= NR_TOPO_LEVELS)
+		return "?";
+	return level_names[level];
+}
+
+static void get_cpulist(char *line, void *data)
+{
+	cpumask_t *mask = (cpumask_t *)data;
+
+	if (cpulist_parse(line, strlen(line), *mask) < 0)
+		cpus_clear(*mask);
+}
+
+static void get_int(char *line, void *data)
+{
+	int *val = (int *)data;
+	*val = strtol(line, NULL, 10);
+}
+
+/*
+ * Create a new group at @level holding every cpu of @mask that has no
+ * group yet.  Cpus beyond nr_cpus are dropped from the mask.
+ */
+static void topology_add_group(Topology_t *topo, int level, int id,
+				const cpumask_t *mask)
+{
+	Topo_group_t *group;
+	int idx = topo->nr_groups[level];
+	int cpu;
+
+	group = &topo->groups[level][idx];
+	cpus_clear(group->mask);
+	group->id = id;
+
+	for_each_cpu_mask(cpu, *mask) {
+		if (cpu >= topo->nr_cpus)
+			break;
+		if (topo->group_of[level][cpu] >= 0)
+			continue;
+		topo->group_of[level][cpu] = idx;
+		cpu_set(cpu, group->mask);
+	}
+
+	if (!cpus_empty(group->mask))
+		topo->nr_groups[level]++;
+}
+
+/* Find the sysfs cache index of the highest cache level for @cpu */
+static int topology_llc_index(int cpu)
+{
+	char path[PATH_MAX];
+	int index, level, llc = -1, llc_level = 0;
+
+	for (index = 0; ; index++) {
+		root_path(path, PATH_MAX, CPU_PATH "/cpu%d/cache/index%d/level",
+				cpu, index);
+		if (process_one_line(path, get_int, &level) < 0)
+			break;
+		if (level > llc_level) {
+			llc_level = level;
+			llc = index;
+		}
+	}
+	return llc;
+}
+
+/*
+ * Read the sibling mask of @cpu for @level.  The first file found wins,
+ * newer kernels renamed some of them.
+ */
+static int topology_read_mask(int cpu, int level, cpumask_t *mask)
+{
+	static const char *core_files[] = {
+		"topology/core_cpus_list", "topology/thread_siblings_list", NULL
+	};
+	static const char *package_files[] = {
+		"topology/package_cpus_list", "topology/core_siblings_list", NULL
+	};
+	const char **files;
+	char path[PATH_MAX];
+	int i;
+
+	cpus_clear(*mask);
+	switch (level) {
+	case TOPO_CORE:
+		files = core_files;
+		break;
+	case TOPO_PACKAGE:
+		files = package_files;
+		break;
+	case TOPO_LLC:
+		i = topology_llc_index(cpu);
+		if (i < 0)
+			return -ENOENT;
+		root_path(path, PATH_MAX,
+			CPU_PATH "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+		if (process_one_line(path, get_cpulist, mask) < 0)
+			return -ENOENT;
+		return cpus_empty(*mask) ? -EINVAL : 0;
+	default:
+		return -EINVAL;
+	}
+
+	for (i = 0; files[i]; i++) {
+		root_path(path, PATH_MAX, CPU_PATH "/cpu%d/%s", cpu, files[i]);
+		if (process_one_line(path, get_cpulist, mask) == 0)
+			return cpus_empty(*mask) ? -EINVAL : 0;
+	}
+	return -ENOENT;
+}
+
+static void topology_scan_level(Topology_t *topo, int level)
+{
+	char path[PATH_MAX];
+	cpumask_t mask;
+	int cpu, id;
+
+	for (cpu = 0; cpu < topo->nr_cpus; cpu++) {
+		if (topo->group_of[level][cpu] >= 0)
+			continue;
+		if (topology_read_mask(cpu, level, &mask) < 0)
+			continue;
+		/* The mask must at least contain the cpu itself */
+		cpu_set(cpu, mask);
+
+		id = cpu;
+		if (level == TOPO_PACKAGE) {
+			root_path(path, PATH_MAX,
+				CPU_PATH "/cpu%d/topology/physical_package_id", cpu);
+			if (process_one_line(path, get_int, &id) < 0)
+				id = cpu;
+		}
+		topology_add_group(topo, level, id, &mask);
+	}
+}
+
+static void topology_scan_nodes(Topology_t *topo)
+{
+	char path[PATH_MAX];
+	DIR *dir;
+	struct dirent *entry;
+	cpumask_t mask;
+
+	root_path(path, PATH_MAX, NODE_PATH);
+	dir = opendir(path);
+	if (!dir) {
+		/* No NUMA support, every cpu lives on node 0 */
+		cpus_clear(mask);
+		bitmap_fill(cpus_addr(mask), topo->nr_cpus);
+		topology_add_group(topo, TOPO_NODE, 0, &mask);
+		return;
+	}
+
+	while ((entry = readdir(dir))) {
+		int num;
+		char pad;
+
+		if (sscanf(entry->d_name, "node%d%c", &num, &pad) != 1)
+			continue;
+		root_path(path, PATH_MAX, NODE_PATH "/%s/cpulist", entry->d_name);
+		cpus_clear(mask);
+		if (process_one_line(path, get_cpulist, &mask) < 0)
+			continue;
+		topology_add_group(topo, TOPO_NODE, num, &mask);
+	}
+	closedir(dir);
+}
+
+int init_topology(Topology_t *topo, unsigned int nr_cpus)
+{
+	cpumask_t mask;
+	int level, cpu;
+
+	memset(topo, 0, sizeof(*topo));
+	topo->nr_cpus = nr_cpus;
+
+	for (level = TOPO_CORE; level < NR_TOPO_LEVELS; level++) {
+		topo->group_of[level] = (int *)malloc(nr_cpus * sizeof(int));
+		topo->groups[level] = (Topo_group_t *)malloc(nr_cpus * sizeof(Topo_group_t));
+		if (!topo->group_of[level] || !topo->groups[level]) {
+			printf("alloc mem for topology failed\n");
+			return -ENOMEM;
+		}
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			topo->group_of[level][cpu] = -1;
+	}
+
+	topology_scan_level(topo, TOPO_CORE);
+	topology_scan_level(topo, TOPO_LLC);
+	topology_scan_level(topo, TOPO_PACKAGE);
+	topology_scan_nodes(topo);
+
+	for (level = TOPO_CORE; level < NR_TOPO_LEVELS; level++) {
+		Topo_group_t *groups;
+
+		/* Cpus without topology info (offline at init) stand alone */
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			if (topo->group_of[level][cpu] >= 0)
+				continue;
+			cpus_clear(mask);
+			cpu_set(cpu, mask);
+			topology_add_group(topo, level, cpu, &mask);
+		}
+
+		groups = realloc(topo->groups[level],
+				topo->nr_groups[level] * sizeof(Topo_group_t));
+		if (groups)
+			topo->groups[level] = groups;
+		topo->stat[level] = (Topo_stat_t *)calloc(topo->nr_groups[level],
+						sizeof(Topo_stat_t));
+		if (!topo->stat[level]) {
+			printf("alloc mem for topology failed\n");
+			return -ENOMEM;
+		}
+#ifdef DEBUG
+		printf("topology %s: %u groups\n", level_names[level],
+				topo->nr_groups[level]);
+#endif
+	}
+
+	return 0;
+}
+
+/*
+ * Aggregate the jiffy deltas and cpufreq of all online cpus into every
+ * topology level in a single pass over the per cpu records.
+ */
+void topology_rollup(Topology_t *topo, const Systeminfo_t *systeminfo)
+{
+	int level, cpu;
+
+	for (level = TOPO_CORE; level < NR_TOPO_LEVELS; level++)
+		memset(topo->stat[level], 0,
+			topo->nr_groups[level] * sizeof(Topo_stat_t));
+
+	for_each_online_cpu(cpu) {
+		unsigned long long busy = 0, total = 0;
+		const Cpu_state_t *state;
+
+		if (cpu >= topo->nr_cpus)
+			break;
+		state = &systeminfo->cpu[cpu];
+		if (state->cur_jiffy.idle >= state->prev_jiffy.idle) {
+			busy = state->cur_jiffy.busy - state->prev_jiffy.busy;
+			total = state->cur_jiffy.total - state->prev_jiffy.total;
+		}
+
+		for (level = TOPO_CORE; level < NR_TOPO_LEVELS; level++) {
+			Topo_stat_t *stat;
+
+			stat = &topo->stat[level][topo->group_of[level][cpu]];
+			stat->busy += busy;
+			stat->total += total;
+			stat->freq_sum += state->cpufreq;
+			stat->nr_online++;
+		}
+	}
+}
+
+void destroy_topology(Topology_t *topo)
+{
+	int level;
+
+	for (level = TOPO_CORE; level < NR_TOPO_LEVELS; level++) {
+		free(topo->group_of[level]);
+		free(topo->groups[level]);
+		free(topo->stat[level]);
+	}
+	memset(topo, 0, sizeof(*topo));
+}
@@ -0,0 +1,47 @@
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+#include "cpumask.h"
+#include "system_monitor.h"
+
+/*
+ * Levels of the cpu hierarchy the per-cpu samples can be rolled up to.
+ * TOPO_CPU is the flat per logical cpu view and has no groups.
+ */
+enum topo_level {
+	TOPO_CPU = 0,
+	TOPO_CORE,		//SMT siblings sharing one core
+	TOPO_LLC,		//cpus sharing the last level cache
+	TOPO_PACKAGE,		//physical package (socket)
+	TOPO_NODE,		//NUMA node
+	NR_TOPO_LEVELS
+};
+
+typedef struct topo_group {
+	cpumask_t	mask;			//member cpus, read once at init
+	int		id;			//package/node id, first cpu otherwise
+}Topo_group_t;
+
+/* Per tick aggregates, kept apart from the masks so clearing them is cheap */
+typedef struct topo_stat {
+	unsigned long long	busy;		//busy jiffies since last tick
+	unsigned long long	total;		//total jiffies since last tick
+	unsigned long long	freq_sum;	//sum of online cpufreq (MHz)
+	unsigned int		nr_online;	//online cpus in this tick
+}Topo_stat_t;
+
+typedef struct topology {
+	unsigned int	nr_cpus;
+	int		*group_of[NR_TOPO_LEVELS];	//cpu -> group index
+	Topo_group_t	*groups[NR_TOPO_LEVELS];
+	Topo_stat_t	*stat[NR_TOPO_LEVELS];
+	unsigned int	nr_groups[NR_TOPO_LEVELS];
+}Topology_t;
+
+int topology_level_parse(const char *name);
+const char *topology_level_name(int level);
+int init_topology(Topology_t *topo, unsigned int nr_cpus);
+void topology_rollup(Topology_t *topo, const Systeminfo_t *systeminfo);
+void destroy_topology(Topology_t *topo);
+
+#endif